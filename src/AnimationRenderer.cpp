@@ -0,0 +1,93 @@
+#include "AnimationRenderer.h"
+
+#include <chrono>
+#include <unordered_map>
+
+AnimationRenderer::SceneSnapshot::~SceneSnapshot()
+{
+	renderer.reset();
+	for (SceneObject *obj : objects)
+		delete obj;
+	delete ambientLight;
+}
+
+AnimationRenderer::AnimationRenderer(int framesInFlight) :
+	writer_m{ framesInFlight },
+	framesInFlight_m{ std::max(1, framesInFlight) }
+{
+}
+
+std::unique_ptr<AnimationRenderer::SceneSnapshot> AnimationRenderer::makeSnapshot(const Animator &animator, int frame,
+	const std::vector<SceneObject *> &scene, const std::vector<SceneObject *> &renderObjects,
+	const std::vector<Light *> &lights, const Light *ambientLight, const glm::vec3 &cameraPos, int width, int height)
+{
+	std::unique_ptr<SceneSnapshot> snapshot(new SceneSnapshot);
+
+	std::unordered_map<const SceneObject *, SceneObject *> clones;
+	for (SceneObject *obj : scene) {
+		SceneObject *clone = obj->clone();
+		clones[obj] = clone;
+		snapshot->objects.push_back(clone);
+	}
+	for (SceneObject *clone : snapshot->objects)
+		clone->relink(clones);
+
+	if (animator.ready())
+		animator.applyFrame(frame, snapshot->objects);
+
+	for (SceneObject *obj : renderObjects)
+		snapshot->renderObjects.push_back(clones[obj]);
+	for (Light *light : lights)
+		snapshot->lights.push_back(static_cast<Light *>(clones[light]));
+	snapshot->ambientLight = static_cast<Light *>(ambientLight->clone());
+
+	// Frames already run side by side, so each renderer traces
+	// only the tiles handed to it on the shared scheduler.
+	snapshot->renderer.reset(new Renderer(snapshot->renderObjects, snapshot->lights, snapshot->ambientLight));
+	snapshot->renderer->setParallel(false);
+	snapshot->renderer->setResolution(width, height);
+	snapshot->renderer->getCamera().setWorldPosition(cameraPos);
+	snapshot->renderer->beginFrame();
+	return snapshot;
+}
+
+bool AnimationRenderer::render(const Animator &animator, const std::vector<SceneObject *> &scene,
+	const std::vector<SceneObject *> &renderObjects, const std::vector<Light *> &lights,
+	const Light *ambientLight, const glm::vec3 &cameraPos, int width, int height,
+	int first, int last, const std::string &prefix, Renderer::RenderMethod rend)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::vector<Tile> frameTiles = TileScheduler::makeTiles(width, height, Renderer::TILE_SIZE);
+
+	for (int batchStart = first; batchStart <= last; batchStart += framesInFlight_m) {
+		int batchEnd = std::min(batchStart + framesInFlight_m - 1, last);
+
+		std::vector<std::unique_ptr<SceneSnapshot>> snapshots;
+		std::vector<Tile> tiles;
+		for (int frame = batchStart; frame <= batchEnd; frame++) {
+			int image = static_cast<int>(snapshots.size());
+			snapshots.push_back(makeSnapshot(animator, frame, scene, renderObjects, lights, ambientLight, cameraPos, width, height));
+			for (Tile tile : frameTiles) {
+				tile.image = image;
+				tiles.push_back(tile);
+			}
+		}
+
+		scheduler_m.run(tiles, [&snapshots, rend](const Tile &tile, int worker) {
+			snapshots[tile.image]->renderer->renderTile(tile, rend);
+		});
+
+		for (int i = 0; i < snapshots.size(); i++) {
+			std::string filename = prefix + std::to_string(batchStart + i) + ".png";
+			std::cout << "Saving Image to " << filename << "...\n";
+			ofPixels pixels;
+			snapshots[i]->renderer->getPixels(pixels);
+			writer_m.save(filename, pixels);
+		}
+	}
+
+	int failures = writer_m.finish();
+	float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Rendered " << last - first + 1 << " frames in " << seconds << " s\n";
+	return failures == 0;
+}
@@ -0,0 +1,59 @@
+#ifndef ANIMATIONRENDERER_H
+#define ANIMATIONRENDERER_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Animator.h"
+#include "ImageWriter.h"
+#include "Renderer.h"
+#include "SceneObject.h"
+#include "TileScheduler.h"
+
+// Renders a range of animation frames with several frames in flight.
+//
+// Each frame gets its own snapshot of the scene, posed by the
+// Animator, so frames never share mutable transforms and the live
+// scene is left untouched. The tiles of every frame in flight go
+// through one shared TileScheduler, and finished frames are handed
+// to an ImageWriter so encoding overlaps with tracing the next batch.
+class AnimationRenderer
+{
+private:
+	// Deep copy of the scene posed at one frame. Mesh geometry is
+	// shared between copies, only transforms are duplicated.
+	struct SceneSnapshot
+	{
+		std::vector<SceneObject *> objects;
+		std::vector<SceneObject *> renderObjects;
+		std::vector<Light *> lights;
+		Light *ambientLight = NULL;
+		std::unique_ptr<Renderer> renderer;
+
+		~SceneSnapshot();
+	};
+
+	TileScheduler scheduler_m;
+	ImageWriter writer_m;
+	int framesInFlight_m;
+
+public:
+	AnimationRenderer(int framesInFlight = 4);
+
+	// Render frames first..last at width x height, each saved to
+	// prefix + frame + ".png". scene is the list the Animator poses;
+	// renderObjects and lights must be drawn from it. Returns false if
+	// any frame failed to save.
+	bool render(const Animator &animator, const std::vector<SceneObject *> &scene,
+		const std::vector<SceneObject *> &renderObjects, const std::vector<Light *> &lights,
+		const Light *ambientLight, const glm::vec3 &cameraPos, int width, int height,
+		int first, int last, const std::string &prefix, Renderer::RenderMethod rend);
+
+private:
+	std::unique_ptr<SceneSnapshot> makeSnapshot(const Animator &animator, int frame,
+		const std::vector<SceneObject *> &scene, const std::vector<SceneObject *> &renderObjects,
+		const std::vector<Light *> &lights, const Light *ambientLight, const glm::vec3 &cameraPos, int width, int height);
+};
+
+#endif
@@ -1,15 +1,184 @@
 #include "Animator.h"
 
+#include <algorithm>
+#include <limits>
+
+// AnimationTrack Functions
+//
+void AnimationTrack::setKey(float time, float value, Easing easing)
+{
+	size_t key = std::lower_bound(times_m.begin(), times_m.end(), time) - times_m.begin();
+	if (key < times_m.size() && times_m[key] == time) {
+		values_m[key] = value;
+		easing_m[key] = easing;
+		return;
+	}
+	times_m.insert(times_m.begin() + key, time);
+	values_m.insert(values_m.begin() + key, value);
+	easing_m.insert(easing_m.begin() + key, easing);
+}
+
+bool AnimationTrack::removeKey(float time)
+{
+	size_t key = std::lower_bound(times_m.begin(), times_m.end(), time) - times_m.begin();
+	if (key == times_m.size() || times_m[key] != time)
+		return false;
+	times_m.erase(times_m.begin() + key);
+	values_m.erase(values_m.begin() + key);
+	easing_m.erase(easing_m.begin() + key);
+	return true;
+}
+
+void AnimationTrack::clear()
+{
+	times_m.clear();
+	values_m.clear();
+	easing_m.clear();
+	hint_m = 0;
+}
+
+float AnimationTrack::sample(float time) const
+{
+	if (times_m.empty())
+		return 0;
+	if (time <= times_m.front())
+		return values_m.front();
+	if (time >= times_m.back())
+		return values_m.back();
+
+	size_t key = findSegment(time);
+	float start = values_m[key];
+	float change = values_m[key + 1] - start;
+	float cFrame = time - times_m[key];
+	float mFrame = times_m[key + 1] - times_m[key];
+	switch (easing_m[key])
+	{
+	case EASE_IN: return Animator::easeIn(cFrame, start, change, mFrame);
+	case EASE_OUT: return Animator::easeOut(cFrame, start, change, mFrame);
+	case EASE_IN_OUT: return Animator::easeInOut(cFrame, start, change, mFrame);
+	default: return Animator::linear(cFrame, start, change, mFrame);
+	}
+}
+
+size_t AnimationTrack::findSegment(float time) const
+{
+	// Playback asks for the hinted segment or the one after it
+	size_t last = times_m.size() - 1;
+	for (size_t key = hint_m; key < last && key <= hint_m + 1; key++) {
+		if (times_m[key] <= time && time < times_m[key + 1]) {
+			hint_m = key;
+			return key;
+		}
+	}
+	hint_m = std::upper_bound(times_m.begin(), times_m.end(), time) - times_m.begin() - 1;
+	return hint_m;
+}
+
+// AnimationBatch Functions
+//
+void AnimationBatch::build(const std::vector<const AnimationTrack *> &tracks)
+{
+	size_t lanes = tracks.size();
+	tracks_m = tracks;
+	// An empty range, so every lane is refreshed on the first evaluate()
+	from_m.assign(lanes, std::numeric_limits<float>::infinity());
+	until_m.assign(lanes, -std::numeric_limits<float>::infinity());
+	begin_m.assign(lanes, 0.0f);
+	invDuration_m.assign(lanes, 0.0f);
+	start_m.assign(lanes, 0.0f);
+	change_m.assign(lanes, 0.0f);
+	quad_m.assign(lanes, 0.0f);
+	lin_m.assign(lanes, 0.0f);
+	mirror_m.assign(lanes, 0.0f);
+	values_m.assign(lanes, 0.0f);
+}
+
+void AnimationBatch::evaluate(float time)
+{
+	size_t lanes = tracks_m.size();
+	for (size_t i = 0; i < lanes; i++) {
+		if (!(from_m[i] <= time && time < until_m[i]))
+			refresh(i, time);
+	}
+
+	const float *begin = begin_m.data();
+	const float *invDuration = invDuration_m.data();
+	const float *start = start_m.data();
+	const float *change = change_m.data();
+	const float *quad = quad_m.data();
+	const float *lin = lin_m.data();
+	const float *mirror = mirror_m.data();
+	float *values = values_m.data();
+	for (size_t i = 0; i < lanes; i++) {
+		float u = std::min(std::max((time - begin[i]) * invDuration[i], 0.0f), 1.0f);
+		// The second half of ease in-out is the first half turned around
+		bool flip = u > 0.5f && mirror[i] != 0.0f;
+		float v = flip ? 1.0f - u : u;
+		float eased = (quad[i] * v + lin[i]) * v;
+		eased = flip ? 1.0f - eased : eased;
+		values[i] = start[i] + change[i] * eased;
+	}
+}
+
+// Caches the segment of lane's track that holds time. Outside the
+// keys a lane holds the first or last value until time comes back.
+void AnimationBatch::refresh(size_t lane, float time)
+{
+	const float infinity = std::numeric_limits<float>::infinity();
+	const AnimationTrack &track = *tracks_m[lane];
+	begin_m[lane] = 0;
+	invDuration_m[lane] = 0;
+	change_m[lane] = 0;
+	quad_m[lane] = 0;
+	lin_m[lane] = 0;
+	mirror_m[lane] = 0;
+	if (track.empty()) {
+		from_m[lane] = -infinity;
+		until_m[lane] = infinity;
+		start_m[lane] = 0;
+		return;
+	}
+
+	size_t last = track.size() - 1;
+	if (time < track.getTime(0)) {
+		from_m[lane] = -infinity;
+		until_m[lane] = track.getTime(0);
+		start_m[lane] = track.getValue(0);
+		return;
+	}
+	if (time >= track.getTime(last)) {
+		from_m[lane] = track.getTime(last);
+		until_m[lane] = infinity;
+		start_m[lane] = track.getValue(last);
+		return;
+	}
+
+	size_t key = track.findSegment(time);
+	from_m[lane] = track.getTime(key);
+	until_m[lane] = track.getTime(key + 1);
+	begin_m[lane] = from_m[lane];
+	invDuration_m[lane] = 1.0f / (until_m[lane] - from_m[lane]);
+	start_m[lane] = track.getValue(key);
+	change_m[lane] = track.getValue(key + 1) - start_m[lane];
+	// The easing functions as polynomials in u
+	switch (track.getEasing(key))
+	{
+	case EASE_IN: quad_m[lane] = 1; break;
+	case EASE_OUT: quad_m[lane] = -1; lin_m[lane] = 2; break;
+	case EASE_IN_OUT: quad_m[lane] = 2; mirror_m[lane] = 1; break;
+	default: lin_m[lane] = 1; break;
+	}
+}
+
+// Animator Functions
+//
 void Animator::play()
 {
-	if (framesStart_m.size() != framesEnd_m.size())
+	if (!ready())
 	{
-		std::cout << "Cannot animate, Start and End scenes have different scene objects.\n"
+		std::cout << "Cannot animate, the scene objects changed since they were keyed.\n"
 			<< "Clearing KeyFrames...\n";
-		framesStart_m.clear();
-		framesEnd_m.clear();
-		startSet_m = false;
-		endSet_m = false;
+		clearKeys();
 		std::cout << "KeyFrames cleared. Please set new Start and End scenes\n";
 		return;
 	}
@@ -23,7 +192,7 @@ void Animator::play()
 
 void Animator::advanceFrame()
 {
-	if (play_m && !scene_m.empty() && startSet_m && endSet_m) {
+	if (play_m && !scene_m.empty() && ready()) {
 		animate();
 		if (currentFrame_m < maxFrame_m) {
 			currentFrame_m++;
@@ -34,47 +203,88 @@ void Animator::advanceFrame()
 
 void Animator::animate()
 {
-	if (play_m && !scene_m.empty() && startSet_m && endSet_m)
+	if (play_m && !scene_m.empty() && ready())
+	{
+		applyFrame(currentFrame_m, scene_m);
+	}
+}
+
+// Every channel is evaluated in one batch, then each transform is
+// written once. Fitting a connector inverts the joint's world matrix,
+// so connectors wait until the whole pose is written and are fitted
+// once each.
+void Animator::applyFrame(int frame, const std::vector<SceneObject *> &targets) const
+{
+	size_t objects = tracks_m.size();
+	if (batchDirty_m) {
+		std::vector<const AnimationTrack *> lanes(objects * CHANNEL_COUNT);
+		for (size_t i = 0; i < objects; i++)
+			for (int c = 0; c < CHANNEL_COUNT; c++)
+				lanes[c * objects + i] = &tracks_m[i].channels_m[c];
+		batch_m.build(lanes);
+		batchDirty_m = false;
+	}
+	batch_m.evaluate(frame);
+	const float *values = batch_m.getValues();
+
+	size_t count = std::min(targets.size(), objects);
+	joints_m.clear();
+	for (size_t i = 0; i < count; i++)
 	{
-		for (int i = 0; i < scene_m.size(); i++)
-		{
-			if (currentFrame_m <= framesEnd_m[i]->cFrame_m) {
-				glm::vec3 position;
-				glm::vec3 rotation;
-				position.x = linear(currentFrame_m, framesStart_m[i]->translate_m.x, framesEnd_m[i]->translate_m.x - framesStart_m[i]->translate_m.x, framesEnd_m[i]->cFrame_m);
-				position.y = linear(currentFrame_m, framesStart_m[i]->translate_m.y, framesEnd_m[i]->translate_m.y - framesStart_m[i]->translate_m.y, framesEnd_m[i]->cFrame_m);
-				position.z = linear(currentFrame_m, framesStart_m[i]->translate_m.z, framesEnd_m[i]->translate_m.z - framesStart_m[i]->translate_m.z, framesEnd_m[i]->cFrame_m);
-				rotation.x = linear(currentFrame_m, framesStart_m[i]->rotate_m.x, framesEnd_m[i]->rotate_m.x - framesStart_m[i]->rotate_m.x, framesEnd_m[i]->cFrame_m);
-				rotation.y = linear(currentFrame_m, framesStart_m[i]->rotate_m.y, framesEnd_m[i]->rotate_m.y - framesStart_m[i]->rotate_m.y, framesEnd_m[i]->cFrame_m);
-				rotation.z = linear(currentFrame_m, framesStart_m[i]->rotate_m.z, framesEnd_m[i]->rotate_m.z - framesStart_m[i]->rotate_m.z, framesEnd_m[i]->cFrame_m);
-
-				scene_m[i]->setLocalPosition(position);
-				scene_m[i]->setLocalRotation(rotation);
-			}
+		// Channels without keys keep their current value
+		const AnimationTrack *channels = tracks_m[i].channels_m;
+		glm::vec3 position = targets[i]->getLocalPosition();
+		glm::vec3 rotation = targets[i]->getLocalRotation();
+		for (int axis = 0; axis < 3; axis++) {
+			if (!channels[TRANSLATE_X + axis].empty())
+				position[axis] = values[(TRANSLATE_X + axis) * objects + i];
+			if (!channels[ROTATE_X + axis].empty())
+				rotation[axis] = values[(ROTATE_X + axis) * objects + i];
 		}
+		targets[i]->setLocalTransform(position, rotation);
+
+		Joint *joint = dynamic_cast<Joint *>(targets[i]);
+		if (joint && joint->hasParent())
+			joints_m.push_back(joint);
 	}
+	for (Joint *joint : joints_m)
+		joint->adjustConnector();
 }
 
-void Animator::initializeStartScene()
+void Animator::setKey(int frame, Easing easing)
 {
-	framesStart_m.clear();
-	for (SceneObject* sceneObj : scene_m)
+	tracks_m.resize(scene_m.size());
+	batchDirty_m = true;
+	for (size_t i = 0; i < scene_m.size(); i++)
 	{
-		framesStart_m.push_back(new KeyFrame{ sceneObj->getLocalPosition(), sceneObj->getLocalRotation(), minFrame_m });
+		glm::vec3 position = scene_m[i]->getLocalPosition();
+		glm::vec3 rotation = scene_m[i]->getLocalRotation();
+		AnimationTrack *channels = tracks_m[i].channels_m;
+		for (int axis = 0; axis < 3; axis++) {
+			channels[TRANSLATE_X + axis].setKey(frame, position[axis], easing);
+			channels[ROTATE_X + axis].setKey(frame, rotation[axis], easing);
+		}
 	}
-	startSet_m = true;
-	endSet_m = false;
+}
+
+void Animator::setKey(size_t object, Channel channel, float frame, float value, Easing easing)
+{
+	if (object >= tracks_m.size())
+		tracks_m.resize(object + 1);
+	batchDirty_m = true;
+	tracks_m[object].channels_m[channel].setKey(frame, value, easing);
+}
+
+void Animator::initializeStartScene()
+{
+	clearKeys();
+	setKey(minFrame_m);
 	std::cout << "Start scene set.\n";
 }
 
 void Animator::initializeEndScene()
 {
-	framesEnd_m.clear();
-	for (SceneObject* sceneObj : scene_m)
-	{
-		framesEnd_m.push_back(new KeyFrame{ sceneObj->getLocalPosition(), sceneObj->getLocalRotation(), maxFrame_m });
-	}
-	endSet_m = true;
+	setKey(maxFrame_m);
 	std::cout << "End scene set.\n";
 }
 
@@ -1,30 +1,111 @@
 #ifndef ANIMATOR_H
 #define ANIMATOR_H
 
+#include <cstdint>
+
 #include "ofMain.h"
 #include "SceneObject.h"
 
-struct KeyFrame
+// How a segment moves from its key to the next one
+enum Easing : uint8_t { EASE_LINEAR, EASE_IN, EASE_OUT, EASE_IN_OUT };
+
+// Keys of one animated value, sorted by frame and kept in contiguous
+// arrays. Each key's easing shapes the segment that starts at it.
+//
+// sample() remembers the segment it last found, so playing frames in
+// order costs O(1) per sample and only jumps binary search. The hint
+// makes sampling one track from several threads at once unsafe.
+class AnimationTrack
 {
-	glm::vec3 translate_m;
-	glm::vec3 rotate_m;
-	//glm::vec3 scale_m;
-	int cFrame_m;
+private:
+	std::vector<float> times_m;
+	std::vector<float> values_m;
+	std::vector<Easing> easing_m;
+	mutable size_t hint_m = 0;
+
+public:
+	// Adds a key, or replaces the one already at time
+	void setKey(float time, float value, Easing easing = EASE_LINEAR);
+	bool removeKey(float time);
+	void clear();
+
+	size_t size() const { return times_m.size(); }
+	bool empty() const { return times_m.empty(); }
+	float getTime(size_t key) const { return times_m[key]; }
+	float getValue(size_t key) const { return values_m[key]; }
+	Easing getEasing(size_t key) const { return easing_m[key]; }
+
+	// Value at time, held at the first and last keys outside them.
+	// An empty track samples as 0.
+	float sample(float time) const;
+	// Index of the key starting the segment that holds time,
+	// for getTime(0) <= time < getTime(size() - 1)
+	size_t findSegment(float time) const;
+};
+
+// Evaluates many tracks at one time together. Each lane is one track,
+// and the segment each lane is in is cached in structure of arrays
+// form, so a frame is a check per lane plus straight loops over float
+// arrays that the compiler can vectorize. A lane only goes back to
+// its track when the time leaves its segment.
+class AnimationBatch
+{
+private:
+	std::vector<const AnimationTrack *> tracks_m;
+	// Times the cached segment covers, from <= time < until
+	std::vector<float> from_m;
+	std::vector<float> until_m;
+	// value = start + change * ease(u), u = (time - begin) * invDuration,
+	// ease(u) = (quad * u + lin) * u, mirrored about u = 0.5 for
+	// ease in-out lanes
+	std::vector<float> begin_m;
+	std::vector<float> invDuration_m;
+	std::vector<float> start_m;
+	std::vector<float> change_m;
+	std::vector<float> quad_m;
+	std::vector<float> lin_m;
+	std::vector<float> mirror_m;
+	std::vector<float> values_m;
+
+public:
+	// Lanes for tracks, in order. Tracks must outlive the batch and
+	// the batch must be rebuilt after any of them change.
+	void build(const std::vector<const AnimationTrack *> &tracks);
+	// Every lane's value at time, like AnimationTrack::sample()
+	void evaluate(float time);
+
+	size_t size() const { return tracks_m.size(); }
+	const float* getValues() const { return values_m.data(); }
+
+private:
+	void refresh(size_t lane, float time);
 };
 
 class Animator
 {
+public:
+	enum Channel { TRANSLATE_X, TRANSLATE_Y, TRANSLATE_Z, ROTATE_X, ROTATE_Y, ROTATE_Z, CHANNEL_COUNT };
+
 private:
-	std::vector<KeyFrame *> framesStart_m;
-	std::vector<KeyFrame *> framesEnd_m;
+	// Tracks of each object, in scene order
+	struct ObjectTracks
+	{
+		AnimationTrack channels_m[CHANNEL_COUNT];
+	};
+
+	std::vector<ObjectTracks> tracks_m;
 	std::vector<SceneObject *> &scene_m;
 
+	// Every channel of every object, channel major: the lane of
+	// channel c of object i is c * tracks_m.size() + i
+	mutable AnimationBatch batch_m;
+	mutable bool batchDirty_m = true;
+	mutable std::vector<Joint *> joints_m;
+
 	int currentFrame_m = 1;
 	int minFrame_m = 1;
 	int maxFrame_m;
 	bool play_m = false;
-	bool startSet_m = false;
-	bool endSet_m = false;
 
 public:
 	Animator(std::vector<SceneObject *> &scene, int maxFrame = 60) : scene_m{ scene }, maxFrame_m { maxFrame }
@@ -44,12 +125,27 @@ public:
 	int getCurrentFrame() { return currentFrame_m; }
 	void advanceFrame();
 	void animate();
+	// True once keys are set for every object of the current scene
+	bool ready() const { return !tracks_m.empty() && tracks_m.size() == scene_m.size(); }
+	// Pose targets (a copy of the scene, same order) at frame,
+	// without touching the live scene
+	void applyFrame(int frame, const std::vector<SceneObject *> &targets) const;
+
+	// Key the position and rotation of every object at frame
+	void setKey(int frame, Easing easing = EASE_LINEAR);
+	// Key one channel of the object at index in the scene
+	void setKey(size_t object, Channel channel, float frame, float value, Easing easing = EASE_LINEAR);
+	const AnimationTrack& getTrack(size_t object, Channel channel) const { return tracks_m[object].channels_m[channel]; }
+	void clearKeys() { tracks_m.clear(); batchDirty_m = true; }
+
+	// Clears every key and keys the scene at the first frame
 	void initializeStartScene();
+	// Keys the scene at the last frame
 	void initializeEndScene();
-	float linear(float cFrame, float start, float change, float mFrame);
-	float easeIn(float cFrame, float start, float change, float mFrame);
-	float easeOut(float cFrame, float start, float change, float mFrame);
-	float easeInOut(float cFrame, float start, float change, float mFrame);
+	static float linear(float cFrame, float start, float change, float mFrame);
+	static float easeIn(float cFrame, float start, float change, float mFrame);
+	static float easeOut(float cFrame, float start, float change, float mFrame);
+	static float easeInOut(float cFrame, float start, float change, float mFrame);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include "BVH.h"
+
+#include <chrono>
+
+void BVH::build(const std::vector<AABB> &primBounds)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	nodes_m.clear();
+	primIndices_m.clear();
+	if (!primBounds.empty()) {
+		std::vector<glm::vec3> centroids;
+		centroids.reserve(primBounds.size());
+		for (int i = 0; i < primBounds.size(); i++) {
+			centroids.push_back(primBounds[i].center());
+			primIndices_m.push_back(i);
+		}
+		nodes_m.reserve(2 * primBounds.size());
+		buildRecurse(primBounds, centroids, 0, static_cast<int>(primBounds.size()), 0);
+	}
+
+	buildTimeMs_m = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Children are always stored after their parent,
+// so a reverse sweep sees both children before the parent.
+void BVH::refit(const std::vector<AABB> &primBounds)
+{
+	for (int n = static_cast<int>(nodes_m.size()) - 1; n >= 0; n--) {
+		BVHNode &node = nodes_m[n];
+		AABB bounds;
+		if (node.count_m > 0) {
+			for (int i = 0; i < node.count_m; i++)
+				bounds.grow(primBounds[primIndices_m[node.offset_m + i]]);
+		}
+		else {
+			bounds.grow(nodes_m[n + 1].bounds_m);
+			bounds.grow(nodes_m[node.offset_m].bounds_m);
+		}
+		node.bounds_m = bounds;
+	}
+}
+
+// Build the subtree over primIndices_m[begin, end) and return its node index
+int BVH::buildRecurse(const std::vector<AABB> &primBounds, const std::vector<glm::vec3> &centroids, int begin, int end, int depth)
+{
+	int nodeIndex = static_cast<int>(nodes_m.size());
+	nodes_m.push_back(BVHNode());
+
+	AABB bounds, centroidBounds;
+	for (int i = begin; i < end; i++) {
+		bounds.grow(primBounds[primIndices_m[i]]);
+		centroidBounds.grow(centroids[primIndices_m[i]]);
+	}
+	nodes_m[nodeIndex].bounds_m = bounds;
+
+	int count = end - begin;
+	glm::vec3 extent = centroidBounds.max_m - centroidBounds.min_m;
+	int axis = 0;
+	if (extent.y > extent[axis]) axis = 1;
+	if (extent.z > extent[axis]) axis = 2;
+
+	// All centroids coincide, there is nothing to split on
+	if (count <= MAX_LEAF_SIZE / 2 || extent[axis] <= 0 || depth >= MAX_DEPTH - 1) {
+		nodes_m[nodeIndex].offset_m = begin;
+		nodes_m[nodeIndex].count_m = count;
+		nodes_m[nodeIndex].axis_m = axis;
+		return nodeIndex;
+	}
+
+	// Bin centroids along the widest axis and sweep the bins
+	// to find the split with the lowest surface area cost.
+	struct Bin { AABB bounds; int count = 0; };
+	Bin bins[SAH_BINS];
+	float scale = SAH_BINS / extent[axis];
+	auto binOf = [&](int prim) {
+		int b = static_cast<int>((centroids[prim][axis] - centroidBounds.min_m[axis]) * scale);
+		return b < SAH_BINS ? b : SAH_BINS - 1;
+	};
+	for (int i = begin; i < end; i++) {
+		Bin &bin = bins[binOf(primIndices_m[i])];
+		bin.count++;
+		bin.bounds.grow(primBounds[primIndices_m[i]]);
+	}
+
+	float cost[SAH_BINS - 1];
+	AABB left;
+	int leftCount = 0;
+	for (int i = 0; i < SAH_BINS - 1; i++) {
+		left.grow(bins[i].bounds);
+		leftCount += bins[i].count;
+		cost[i] = leftCount * left.surfaceArea();
+	}
+	AABB right;
+	int rightCount = 0;
+	for (int i = SAH_BINS - 1; i > 0; i--) {
+		right.grow(bins[i].bounds);
+		rightCount += bins[i].count;
+		cost[i - 1] += rightCount * right.surfaceArea();
+	}
+
+	int bestSplit = 0;
+	for (int i = 1; i < SAH_BINS - 1; i++) {
+		if (cost[i] < cost[bestSplit])
+			bestSplit = i;
+	}
+
+	// Relative cost of traversal vs. one primitive test is taken as 1
+	float leafCost = static_cast<float>(count);
+	float splitCost = 1 + cost[bestSplit] / bounds.surfaceArea();
+	if (count <= MAX_LEAF_SIZE && leafCost <= splitCost) {
+		nodes_m[nodeIndex].offset_m = begin;
+		nodes_m[nodeIndex].count_m = count;
+		nodes_m[nodeIndex].axis_m = axis;
+		return nodeIndex;
+	}
+
+	int mid = static_cast<int>(std::partition(primIndices_m.begin() + begin, primIndices_m.begin() + end,
+		[&](int prim) { return binOf(prim) <= bestSplit; }) - primIndices_m.begin());
+	if (mid == begin || mid == end)
+		mid = begin + count / 2;
+
+	buildRecurse(primBounds, centroids, begin, mid, depth + 1);
+	int second = buildRecurse(primBounds, centroids, mid, end, depth + 1);
+	nodes_m[nodeIndex].offset_m = second;
+	nodes_m[nodeIndex].count_m = 0;
+	nodes_m[nodeIndex].axis_m = axis;
+	return nodeIndex;
+}
@@ -0,0 +1,182 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+
+#include "ofMain.h"
+
+// Axis aligned bounding box
+struct AABB
+{
+	glm::vec3 min_m = glm::vec3(FLT_MAX);
+	glm::vec3 max_m = glm::vec3(-FLT_MAX);
+
+	void grow(const glm::vec3 &p) { min_m = glm::min(min_m, p); max_m = glm::max(max_m, p); }
+	void grow(const AABB &b) { min_m = glm::min(min_m, b.min_m); max_m = glm::max(max_m, b.max_m); }
+	bool valid() const { return min_m.x <= max_m.x; }
+	glm::vec3 center() const { return (min_m + max_m) * 0.5f; }
+	bool overlaps(const AABB &b) const
+	{
+		return min_m.x <= b.max_m.x && b.min_m.x <= max_m.x
+			&& min_m.y <= b.max_m.y && b.min_m.y <= max_m.y
+			&& min_m.z <= b.max_m.z && b.min_m.z <= max_m.z;
+	}
+	float surfaceArea() const
+	{
+		if (!valid()) return 0;
+		glm::vec3 e = max_m - min_m;
+		return 2 * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+
+	// Box around this box after transforming it by m
+	AABB transformed(const glm::mat4 &m) const
+	{
+		AABB b;
+		for (int i = 0; i < 8; i++) {
+			glm::vec3 corner((i & 1) ? max_m.x : min_m.x, (i & 2) ? max_m.y : min_m.y, (i & 4) ? max_m.z : min_m.z);
+			b.grow(glm::vec3(m * glm::vec4(corner, 1.0)));
+		}
+		return b;
+	}
+
+	// Slab test, invDir is 1 / ray direction
+	bool intersect(const glm::vec3 &orig, const glm::vec3 &invDir, float tMax) const
+	{
+		float t0 = 0, t1 = tMax;
+		for (int a = 0; a < 3; a++) {
+			float tNear = (min_m[a] - orig[a]) * invDir[a];
+			float tFar = (max_m[a] - orig[a]) * invDir[a];
+			if (tNear > tFar) std::swap(tNear, tFar);
+			t0 = tNear > t0 ? tNear : t0;
+			t1 = tFar < t1 ? tFar : t1;
+			if (t0 > t1) return false;
+		}
+		return true;
+	}
+};
+
+// Flattened BVH node. Interior nodes store their first child right
+// after themselves and the second child at offset_m. Leaf nodes store
+// count_m primitives starting at offset_m in the primitive index list.
+// A leaf that can't be split (all centroids equal, or at MAX_DEPTH)
+// holds every primitive left, so count_m is a full int.
+struct BVHNode
+{
+	AABB bounds_m;
+	int offset_m;
+	int count_m;
+	unsigned char axis_m;
+};
+
+// Bounding volume hierarchy over a set of primitive boxes,
+// built with a binned surface area heuristic.
+class BVH
+{
+public:
+	// Deepest tree build() makes, also the traversal stack size
+	static const int MAX_DEPTH{ 64 };
+
+private:
+	static const int SAH_BINS{ 12 };
+	static const int MAX_LEAF_SIZE{ 4 };
+
+	std::vector<BVHNode> nodes_m;
+	std::vector<int> primIndices_m;
+	float buildTimeMs_m = 0;
+
+public:
+	void build(const std::vector<AABB> &primBounds);
+	// Update node bounds for moved primitives, keeping the topology
+	void refit(const std::vector<AABB> &primBounds);
+	void clear() { nodes_m.clear(); primIndices_m.clear(); }
+
+	bool empty() const { return nodes_m.empty(); }
+	int getNodeCount() const { return static_cast<int>(nodes_m.size()); }
+	float getBuildTime() const { return buildTimeMs_m; }
+	size_t getMemoryUsage() const { return nodes_m.capacity() * sizeof(BVHNode) + primIndices_m.capacity() * sizeof(int); }
+	const std::vector<BVHNode> &getNodes() const { return nodes_m; }
+	const std::vector<int> &getPrimIndices() const { return primIndices_m; }
+
+	// Visit every primitive whose leaf box the ray enters, nearest
+	// subtree first. hitPrim(primIndex, tMax) returns true when it
+	// found a closer hit and has shrunk tMax; traversal then culls
+	// boxes beyond the new tMax. Returns true if any primitive hit.
+	template <typename F>
+	bool traverse(const glm::vec3 &orig, const glm::vec3 &dir, float &tMax, F hitPrim) const
+	{
+		if (nodes_m.empty()) return false;
+
+		glm::vec3 invDir = 1.0f / dir;
+		bool dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+		int stack[MAX_DEPTH];
+		int stackSize = 0;
+		int current = 0;
+		bool hit = false;
+		while (true) {
+			const BVHNode &node = nodes_m[current];
+			if (node.bounds_m.intersect(orig, invDir, tMax)) {
+				if (node.count_m > 0) {
+					for (int i = 0; i < node.count_m; i++) {
+						if (hitPrim(primIndices_m[node.offset_m + i], tMax))
+							hit = true;
+					}
+					if (stackSize == 0) break;
+					current = stack[--stackSize];
+				}
+				else if (dirIsNeg[node.axis_m]) {
+					stack[stackSize++] = current + 1;
+					current = node.offset_m;
+				}
+				else {
+					stack[stackSize++] = node.offset_m;
+					current = current + 1;
+				}
+			}
+			else {
+				if (stackSize == 0) break;
+				current = stack[--stackSize];
+			}
+		}
+		return hit;
+	}
+
+	// Like traverse, but stops at the first primitive for which
+	// hitPrim(primIndex) returns true.
+	template <typename F>
+	bool traverseAny(const glm::vec3 &orig, const glm::vec3 &dir, float tMax, F hitPrim) const
+	{
+		if (nodes_m.empty()) return false;
+
+		glm::vec3 invDir = 1.0f / dir;
+		int stack[MAX_DEPTH];
+		int stackSize = 0;
+		int current = 0;
+		while (true) {
+			const BVHNode &node = nodes_m[current];
+			if (node.bounds_m.intersect(orig, invDir, tMax)) {
+				if (node.count_m > 0) {
+					for (int i = 0; i < node.count_m; i++) {
+						if (hitPrim(primIndices_m[node.offset_m + i]))
+							return true;
+					}
+					if (stackSize == 0) break;
+					current = stack[--stackSize];
+				}
+				else {
+					stack[stackSize++] = node.offset_m;
+					current = current + 1;
+				}
+			}
+			else {
+				if (stackSize == 0) break;
+				current = stack[--stackSize];
+			}
+		}
+		return false;
+	}
+
+private:
+	int buildRecurse(const std::vector<AABB> &primBounds, const std::vector<glm::vec3> &centroids, int begin, int end, int depth);
+};
+
+#endif
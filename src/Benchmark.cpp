@@ -0,0 +1,127 @@
+#include "Benchmark.h"
+
+#include <chrono>
+#include <limits>
+#include <random>
+
+#include "BVH.h"
+#include "SceneObject.h"
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	float elapsedMs(Clock::time_point start)
+	{
+		return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+	}
+
+	// Rays from a sphere around the bounds aimed at random points inside them,
+	// seeded so every run fires the same rays.
+	std::vector<Ray> makeRays(const AABB &bounds, int count)
+	{
+		std::mt19937 rng(116);
+		std::uniform_real_distribution<float> unit(0, 1);
+		glm::vec3 center = bounds.center();
+		float radius = glm::length(bounds.max_m - bounds.min_m);
+
+		std::vector<Ray> rays;
+		rays.reserve(count);
+		for (int i = 0; i < count; i++) {
+			glm::vec3 dir = glm::normalize(glm::vec3(unit(rng) - 0.5f, unit(rng) - 0.5f, unit(rng) - 0.5f));
+			glm::vec3 target = bounds.min_m + (bounds.max_m - bounds.min_m) * glm::vec3(unit(rng), unit(rng), unit(rng));
+			glm::vec3 orig = center + dir * radius;
+			rays.push_back(Ray(orig, glm::normalize(target - orig)));
+		}
+		return rays;
+	}
+}
+
+void Benchmark::meshIntersect(const ofMesh &mesh, int rayCount)
+{
+	Mesh obj(glm::vec3(0, 0, 0), mesh);
+	const TriangleBuffer &tris = obj.getTriangles();
+	if (tris.size() == 0) {
+		std::cout << "Mesh intersect benchmark: mesh has no triangles.\n";
+		return;
+	}
+	std::vector<Ray> rays = makeRays(obj.getBVH().getNodes()[0].bounds_m, rayCount);
+
+	// Before: what Mesh::intersect used to do on every ray
+	int hitsBefore = 0;
+	Clock::time_point start = Clock::now();
+	for (const Ray &ray : rays) {
+		bool hit = false;
+		float nearestDist = FLT_MAX;
+		glm::vec2 bary;
+		for (ofMeshFace tri : mesh.getUniqueFaces()) {
+			float dist;
+			if (glm::intersectRayTriangle(ray.getPosition(), ray.getDirection(), tri.getVertex(0), tri.getVertex(1), tri.getVertex(2), bary, dist) && dist < nearestDist) {
+				nearestDist = dist;
+				hit = true;
+			}
+		}
+		hitsBefore += hit;
+	}
+	float beforeMs = elapsedMs(start);
+
+	// Packed triangles, still testing every one
+	int hitsPacked = 0;
+	start = Clock::now();
+	for (const Ray &ray : rays) {
+		bool hit = false;
+		float nearestDist = FLT_MAX;
+		for (int i = 0; i < tris.size(); i++) {
+			float dist;
+			if (tris.intersect(i, ray.getPosition(), ray.getDirection(), dist) && dist < nearestDist) {
+				nearestDist = dist;
+				hit = true;
+			}
+		}
+		hitsPacked += hit;
+	}
+	float packedMs = elapsedMs(start);
+
+	// Packed triangles + BVH
+	int hitsAfter = 0;
+	start = Clock::now();
+	for (const Ray &ray : rays) {
+		glm::vec3 point, normal;
+		hitsAfter += obj.intersect(ray, point, normal);
+	}
+	float afterMs = elapsedMs(start);
+
+	std::cout << "Mesh intersect benchmark: " << tris.size() << " triangles, " << rayCount << " rays\n"
+		<< "  getUniqueFaces scan: " << beforeMs << " ms (" << hitsBefore << " hits)\n"
+		<< "  packed scan:         " << packedMs << " ms (" << hitsPacked << " hits)\n"
+		<< "  packed + BVH:        " << afterMs << " ms (" << hitsAfter << " hits)\n"
+		<< "  speedup:             " << beforeMs / packedMs << "x packed, " << beforeMs / afterMs << "x with BVH\n";
+}
+
+bool Benchmark::bvhDegenerateLeaf(int primCount)
+{
+	// Nested boxes around the origin, far more than fit a 16 bit count
+	std::vector<AABB> boxes;
+	boxes.reserve(primCount);
+	for (int i = 0; i < primCount; i++) {
+		AABB box;
+		float half = 1.0f + i * 1e-5f;
+		box.grow(glm::vec3(-half));
+		box.grow(glm::vec3(half));
+		boxes.push_back(box);
+	}
+
+	BVH bvh;
+	bvh.build(boxes);
+	int visited = 0;
+	float tMax = std::numeric_limits<float>::max();
+	bvh.traverse(glm::vec3(0, 0, -10), glm::vec3(0, 0, 1), tMax, [&visited](int prim, float &t) {
+		visited++;
+		return false;
+	});
+
+	bool ok = visited == primCount;
+	std::cout << "BVH over " << primCount << " coincident primitives: " << bvh.getNodeCount() << " nodes, "
+		<< visited << " primitives reached" << (ok ? "" : " (some were lost!)") << '\n';
+	return ok;
+}
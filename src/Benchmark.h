@@ -0,0 +1,20 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "ofMain.h"
+
+// Renderer micro benchmarks, results are printed to stdout
+namespace Benchmark
+{
+	// Time rays against mesh three ways: the old per-ray
+	// getUniqueFaces() scan, a linear scan of the packed
+	// TriangleBuffer, and Mesh::intersect (packed + BVH).
+	void meshIntersect(const ofMesh &mesh, int rayCount = 2000);
+
+	// Build a BVH over primCount boxes with one shared centroid, which
+	// has to end up in a single leaf, and check that a ray through
+	// them visits every primitive. Returns false if any went missing.
+	bool bvhDegenerateLeaf(int primCount = 100000);
+}
+
+#endif
@@ -0,0 +1,302 @@
+#include "BenchmarkSuite.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "Benchmark.h"
+#include "Renderer.h"
+#include "RenderStats.h"
+#include "SceneFile.h"
+#include "SceneObject.h"
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const int WIDTH{ 320 };
+	const int HEIGHT{ 200 };
+
+	// Objects and lights of one benchmark scene, owned here
+	struct BenchScene
+	{
+		std::vector<SceneObject *> objects;
+		std::vector<Light *> lights;
+		Light *ambientLight = new Light(glm::vec3(0, 0, 0), 0.23);
+
+		BenchScene()
+		{
+			objects.push_back(new Plane(glm::vec3(0, -2, 0), glm::vec3(0, 1, 0)));
+		}
+		~BenchScene()
+		{
+			for (SceneObject *obj : objects)
+				delete obj;
+			for (Light *light : lights)
+				delete light;
+			delete ambientLight;
+		}
+	};
+
+	struct Case
+	{
+		const char *scene;
+		Renderer::RenderMethod method;
+	};
+
+	const Case cases[] = {
+		{ "sphere_grid", Renderer::RenderMethod::RAY_TRACE },
+		{ "sphere_grid", Renderer::RenderMethod::RAY_MARCH },
+		{ "teapot", Renderer::RenderMethod::RAY_TRACE },
+		{ "skeleton", Renderer::RenderMethod::RAY_TRACE },
+		{ "many_lights", Renderer::RenderMethod::RAY_TRACE },
+		{ "sdf_spheres", Renderer::RenderMethod::RAY_MARCH },
+	};
+
+	struct Result
+	{
+		std::string scene;
+		std::string method;
+		int objects;
+		int lights;
+		float medianMs;
+		float p95Ms;
+		double mraysPerSec;
+	};
+
+	bool buildScene(const std::string &name, BenchScene &scene)
+	{
+		if (name == "sphere_grid" || name == "sdf_spheres") {
+			// Spheres on the ground, 8 x 8 for the ray trace grid
+			// and 4 x 4 for the slower ray marched SDF scene
+			int count = name == "sphere_grid" ? 8 : 4;
+			for (int i = 0; i < count; i++) {
+				for (int j = 0; j < count; j++) {
+					glm::vec3 pos(-3.5f + i * 7.0f / (count - 1), -1.6f, -6.0f + j * 7.0f / (count - 1));
+					scene.objects.push_back(new Sphere(pos, 0.4f, ofColor(40 + 25 * i, 200, 40 + 25 * j)));
+				}
+			}
+			scene.lights.push_back(new Light(glm::vec3(0, 4, 4), 0.8));
+			return true;
+		}
+		if (name == "teapot") {
+			// ofxAssimpModelLoader would upload to the GPU, which needs a window
+			ofMesh mesh;
+			if (!SceneFile::loadObj(ofToDataPath("teapot.obj"), mesh))
+				return false;
+			scene.objects.push_back(new Mesh(glm::vec3(0, -2, 0), mesh));
+			scene.lights.push_back(new Light(glm::vec3(0, 4, 4), 0.8));
+			return true;
+		}
+		if (name == "skeleton") {
+			scene.lights.push_back(new Light(glm::vec3(0, 4, 4), 0.8));
+			return SceneFile::load(ofToDataPath("JointSkeleStand.so"), scene.objects);
+		}
+		if (name == "many_lights") {
+			for (int i = 0; i < 3; i++)
+				scene.objects.push_back(new Sphere(glm::vec3(-2.5f + 2.5f * i, -1, 0), 1));
+			// Ring of 16 lights sharing the key light's brightness
+			for (int i = 0; i < 16; i++) {
+				float angle = TWO_PI * i / 16;
+				scene.lights.push_back(new Light(glm::vec3(5 * cos(angle), 4, 5 * sin(angle)), 0.8 / 16));
+			}
+			return true;
+		}
+		return false;
+	}
+
+	float percentile(std::vector<float> sorted, float p)
+	{
+		int index = static_cast<int>(std::ceil(p * sorted.size())) - 1;
+		return sorted[std::max(0, std::min(index, static_cast<int>(sorted.size()) - 1))];
+	}
+
+	// Peak resident set size of the process so far
+	long peakRssKB()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+			return static_cast<long>(counters.PeakWorkingSetSize / 1024);
+		return 0;
+#else
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage))
+			return 0;
+#ifdef __APPLE__
+		return usage.ru_maxrss / 1024;	// bytes on macOS
+#else
+		return usage.ru_maxrss;
+#endif
+#endif
+	}
+
+	std::string toJson(const std::vector<Result> &results, int iterations, bool parallel, bool relaxedMarch, bool sdfCache, long rssKB)
+	{
+		std::stringstream json;
+		json << "{\n"
+			<< "  \"width\": " << WIDTH << ",\n"
+			<< "  \"height\": " << HEIGHT << ",\n"
+			<< "  \"iterations\": " << iterations << ",\n"
+			<< "  \"parallel\": " << (parallel ? "true" : "false") << ",\n"
+			<< "  \"relaxed_march\": " << (relaxedMarch ? "true" : "false") << ",\n"
+			<< "  \"sdf_cache\": " << (sdfCache ? "true" : "false") << ",\n"
+			<< "  \"peak_rss_kb\": " << rssKB << ",\n"
+			<< "  \"results\": [";
+		for (int i = 0; i < results.size(); i++) {
+			const Result &r = results[i];
+			json << (i ? ",\n" : "\n")
+				<< "    { \"scene\": \"" << r.scene << "\", \"method\": \"" << r.method
+				<< "\", \"objects\": " << r.objects << ", \"lights\": " << r.lights
+				<< ", \"median_ms\": " << r.medianMs << ", \"p95_ms\": " << r.p95Ms
+				<< ", \"mrays_per_sec\": " << r.mraysPerSec << " }";
+		}
+		json << "\n  ]\n}\n";
+		return json.str();
+	}
+}
+
+bool BenchmarkSuite::requested(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; i++) {
+		if (!std::strcmp(argv[i], "--benchmark"))
+			return true;
+	}
+	return false;
+}
+
+int BenchmarkSuite::run(int argc, char *argv[])
+{
+	int iterations = 5;
+	std::string only;
+	std::string jsonPath;
+	bool parallel = true;
+	bool relaxedMarch = false;
+	bool sdfCache = false;
+
+	for (int i = 1; i < argc; i++) {
+		bool hasValue = i + 1 < argc;
+		if (!std::strcmp(argv[i], "--benchmark")) {
+			// Already dispatched on by main
+		}
+		else if (!std::strcmp(argv[i], "--iterations") && hasValue) {
+			iterations = std::atoi(argv[++i]);
+			if (iterations < 1) {
+				std::cerr << "Bad --iterations value " << argv[i] << '\n';
+				return BAD_ARGUMENTS;
+			}
+		}
+		else if (!std::strcmp(argv[i], "--only") && hasValue) {
+			only = argv[++i];
+		}
+		else if (!std::strcmp(argv[i], "--json") && hasValue) {
+			jsonPath = argv[++i];
+		}
+		else if (!std::strcmp(argv[i], "--serial")) {
+			parallel = false;
+		}
+		else if (!std::strcmp(argv[i], "--relaxed-march")) {
+			relaxedMarch = true;
+		}
+		else if (!std::strcmp(argv[i], "--sdf-cache")) {
+			sdfCache = true;
+		}
+		else {
+			std::cerr << "Usage: " << argv[0] << " --benchmark [--iterations N] [--only <scene>]\n"
+				<< "       [--serial] [--relaxed-march] [--sdf-cache] [--json <file>]\n";
+			return BAD_ARGUMENTS;
+		}
+	}
+
+	if (!Benchmark::bvhDegenerateLeaf())
+		return CHECK_FAILED;
+
+	std::vector<Result> results;
+	for (const Case &c : cases) {
+		if (!only.empty() && only != c.scene)
+			continue;
+
+		BenchScene scene;
+		if (!buildScene(c.scene, scene)) {
+			std::cerr << "Benchmark scene " << c.scene << " could not be built!\n";
+			return SCENE_LOAD_FAILED;
+		}
+		// Nothing in the benchmark scenes moves, so everything may be baked
+		if (sdfCache) {
+			for (SceneObject *obj : scene.objects)
+				obj->setStatic(true);
+		}
+		Renderer renderer{ scene.objects, scene.lights, scene.ambientLight };
+		renderer.setParallel(parallel);
+		renderer.setResolution(WIDTH, HEIGHT);
+		renderer.setRelaxedMarch(relaxedMarch);
+		renderer.setBakedSDF(sdfCache);
+
+		// Warm up caches, the scene BVH and the thread pool
+		renderer.renderFrame(c.method);
+
+		std::vector<float> times;
+		uint64_t rays = 0;
+		RenderStats::reset();
+		for (int i = 0; i < iterations; i++) {
+			Clock::time_point start = Clock::now();
+			renderer.renderFrame(c.method);
+			times.push_back(std::chrono::duration<float, std::milli>(Clock::now() - start).count());
+		}
+#if RENDER_STATS
+		RenderStats::Counters counters = RenderStats::collect();
+		rays = counters[RenderStats::PRIMARY_RAYS] + counters[RenderStats::SHADOW_RAYS];
+#else
+		rays = static_cast<uint64_t>(WIDTH) * HEIGHT * iterations;
+#endif
+
+		std::sort(times.begin(), times.end());
+		float totalMs = 0;
+		for (float t : times)
+			totalMs += t;
+
+		Result result;
+		result.scene = c.scene;
+		result.method = c.method == Renderer::RenderMethod::RAY_MARCH ? "ray_march" : "ray_trace";
+		result.objects = static_cast<int>(scene.objects.size());
+		result.lights = static_cast<int>(scene.lights.size());
+		result.medianMs = percentile(times, 0.5f);
+		result.p95Ms = percentile(times, 0.95f);
+		result.mraysPerSec = rays / (totalMs * 1000.0);
+		results.push_back(result);
+
+		std::cout << std::left << std::setw(14) << result.scene << std::setw(11) << result.method
+			<< "median " << std::setw(9) << result.medianMs << " ms  p95 " << std::setw(9) << result.p95Ms
+			<< " ms  " << result.mraysPerSec << " Mrays/s\n";
+	}
+	if (results.empty()) {
+		std::cerr << "No benchmark scene named " << only << '\n';
+		return BAD_ARGUMENTS;
+	}
+
+	long rssKB = peakRssKB();
+	std::cout << "Peak RSS: " << rssKB << " KB\n";
+
+	if (jsonPath == "-") {
+		std::cout << toJson(results, iterations, parallel, relaxedMarch, sdfCache, rssKB);
+	}
+	else if (!jsonPath.empty()) {
+		std::ofstream jsonFile(ofToDataPath(jsonPath));
+		jsonFile << toJson(results, iterations, parallel, relaxedMarch, sdfCache, rssKB);
+		if (!jsonFile) {
+			std::cerr << jsonPath << " could not be written!\n";
+			return OUTPUT_FAILED;
+		}
+	}
+	return SUCCESS;
+}
@@ -0,0 +1,35 @@
+#ifndef BENCHMARKSUITE_H
+#define BENCHMARKSUITE_H
+
+// Renderer throughput benchmark over a fixed set of scenes, run
+// without a window like HeadlessRender.
+//
+// Usage: <app> --benchmark [--iterations N] [--only <scene>]
+//              [--serial] [--relaxed-march] [--sdf-cache] [--json <file>]
+//
+// Scenes: sphere_grid, teapot, skeleton, many_lights and sdf_spheres,
+// each built the same way on every run. Every case is rendered at
+// 320x200 once to warm up and then N times (default 5). Median and
+// p95 frame time, Mrays/s and peak RSS are printed as a table. --json
+// writes them as JSON too, "-" meaning stdout. --sdf-cache marks every
+// object static so ray marched scenes run on the baked SDF.
+//
+// A BVH over a large degenerate input is checked first, and nothing
+// is timed if it loses primitives.
+namespace BenchmarkSuite
+{
+	enum ExitCode
+	{
+		SUCCESS = 0,
+		BAD_ARGUMENTS = 1,
+		SCENE_LOAD_FAILED = 2,
+		OUTPUT_FAILED = 3,
+		CHECK_FAILED = 4,
+	};
+
+	// True if the arguments ask for the benchmark suite
+	bool requested(int argc, char *argv[]);
+	int run(int argc, char *argv[]);
+}
+
+#endif
@@ -0,0 +1,257 @@
+#include "HeadlessRender.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "Renderer.h"
+#include "SceneFile.h"
+#include "SceneObject.h"
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	void printUsage(const char *app)
+	{
+		std::cerr << "Usage: " << app << " --render <image> [--scene <file.so|file.sob>] [--camera x,y,z]\n"
+			<< "       [--light x,y,z,intensity]... [--size WxH] [--stats <file.json>]\n"
+			<< "       [--march] [--relaxed-march] [--march-steps N] [--sdf-cache] [--serial] [--packets]\n"
+			<< "       [--aa N] [--aa-threshold T] [--sample-image <image>] [--depth 8|16|float]\n";
+	}
+
+	// Parse "a,b,c" (or "a,b,c,d") into count floats
+	bool parseFloats(const char *arg, float *out, int count)
+	{
+		std::string str(arg);
+		std::replace(str.begin(), str.end(), ',', ' ');
+		std::stringstream data(str);
+		for (int i = 0; i < count; i++) {
+			if (!(data >> out[i]))
+				return false;
+		}
+		return true;
+	}
+
+	// Parse "WxH" into two positive ints
+	bool parseSize(const char *arg, int &width, int &height)
+	{
+		char x;
+		std::stringstream data(arg);
+		return (data >> width >> x >> height) && x == 'x' && data.eof() && width > 0 && height > 0;
+	}
+
+	float toMB(size_t bytes)
+	{
+		return bytes / (1024.0f * 1024.0f);
+	}
+
+	float elapsedMs(Clock::time_point start)
+	{
+		return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+	}
+}
+
+bool HeadlessRender::requested(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; i++) {
+		if (!std::strcmp(argv[i], "--render"))
+			return true;
+	}
+	return false;
+}
+
+int HeadlessRender::run(int argc, char *argv[])
+{
+	std::string imagePath;
+	std::string scenePath;
+	std::string statsPath;
+	glm::vec3 cameraPos(0, 0, 10);
+	int width = Renderer::DEFAULT_WIDTH;
+	int height = Renderer::DEFAULT_HEIGHT;
+	std::vector<glm::vec4> lightArgs;
+	Renderer::RenderMethod method = Renderer::RenderMethod::RAY_TRACE;
+	bool parallel = true;
+	bool packets = false;
+	bool relaxedMarch = false;
+	int marchSteps = 0;
+	bool sdfCache = false;
+	int aaSamples = 1;
+	float aaThreshold = Renderer::DEFAULT_AA_THRESHOLD;
+	std::string sampleImagePath;
+	ImageSink::Depth depth = ImageSink::DEPTH_8;
+
+	for (int i = 1; i < argc; i++) {
+		bool hasValue = i + 1 < argc;
+		if (!std::strcmp(argv[i], "--render") && hasValue) {
+			imagePath = argv[++i];
+		}
+		else if (!std::strcmp(argv[i], "--scene") && hasValue) {
+			scenePath = argv[++i];
+		}
+		else if (!std::strcmp(argv[i], "--stats") && hasValue) {
+			statsPath = argv[++i];
+		}
+		else if (!std::strcmp(argv[i], "--camera") && hasValue) {
+			float cam[3];
+			if (!parseFloats(argv[++i], cam, 3)) {
+				std::cerr << "Bad --camera value " << argv[i] << '\n';
+				return BAD_ARGUMENTS;
+			}
+			cameraPos = glm::vec3(cam[0], cam[1], cam[2]);
+		}
+		else if (!std::strcmp(argv[i], "--light") && hasValue) {
+			float light[4];
+			if (!parseFloats(argv[++i], light, 4)) {
+				std::cerr << "Bad --light value " << argv[i] << '\n';
+				return BAD_ARGUMENTS;
+			}
+			lightArgs.push_back(glm::vec4(light[0], light[1], light[2], light[3]));
+		}
+		else if (!std::strcmp(argv[i], "--size") && hasValue) {
+			if (!parseSize(argv[++i], width, height)) {
+				std::cerr << "Bad --size value " << argv[i] << '\n';
+				return BAD_ARGUMENTS;
+			}
+		}
+		else if (!std::strcmp(argv[i], "--march")) {
+			method = Renderer::RenderMethod::RAY_MARCH;
+		}
+		else if (!std::strcmp(argv[i], "--relaxed-march")) {
+			relaxedMarch = true;
+		}
+		else if (!std::strcmp(argv[i], "--march-steps") && hasValue) {
+			marchSteps = std::atoi(argv[++i]);
+			if (marchSteps < 1) {
+				std::cerr << "Bad --march-steps value " << argv[i] << '\n';
+				return BAD_ARGUMENTS;
+			}
+		}
+		else if (!std::strcmp(argv[i], "--aa") && hasValue) {
+			aaSamples = std::atoi(argv[++i]);
+			if (aaSamples < 1) {
+				std::cerr << "Bad --aa value " << argv[i] << '\n';
+				return BAD_ARGUMENTS;
+			}
+		}
+		else if (!std::strcmp(argv[i], "--aa-threshold") && hasValue) {
+			if (!parseFloats(argv[++i], &aaThreshold, 1) || aaThreshold < 0) {
+				std::cerr << "Bad --aa-threshold value " << argv[i] << '\n';
+				return BAD_ARGUMENTS;
+			}
+		}
+		else if (!std::strcmp(argv[i], "--sample-image") && hasValue) {
+			sampleImagePath = argv[++i];
+		}
+		else if (!std::strcmp(argv[i], "--depth") && hasValue) {
+			std::string value = argv[++i];
+			if (value == "8")
+				depth = ImageSink::DEPTH_8;
+			else if (value == "16")
+				depth = ImageSink::DEPTH_16;
+			else if (value == "float")
+				depth = ImageSink::DEPTH_FLOAT;
+			else {
+				std::cerr << "Bad --depth value " << value << '\n';
+				return BAD_ARGUMENTS;
+			}
+		}
+		else if (!std::strcmp(argv[i], "--sdf-cache")) {
+			sdfCache = true;
+		}
+		else if (!std::strcmp(argv[i], "--serial")) {
+			parallel = false;
+		}
+		else if (!std::strcmp(argv[i], "--packets")) {
+			packets = true;
+		}
+		else {
+			printUsage(argv[0]);
+			return BAD_ARGUMENTS;
+		}
+	}
+	if (imagePath.empty()) {
+		printUsage(argv[0]);
+		return BAD_ARGUMENTS;
+	}
+
+	// Same default scene as ofApp::setup
+	std::vector<SceneObject *> renderObjects;
+	std::vector<Light *> lights;
+	Light* ambientLight = new Light(glm::vec3(0, 0, 0), 0.23);
+	if (lightArgs.empty())
+		lights.push_back(new Light(glm::vec3(0, 4, 4), 0.8));
+	for (const glm::vec4 &l : lightArgs)
+		lights.push_back(new Light(glm::vec3(l.x, l.y, l.z), l.w));
+	renderObjects.push_back(new Plane(glm::vec3(0, -2, 0), glm::vec3(0, 1, 0)));
+
+	int status = SUCCESS;
+	Clock::time_point start = Clock::now();
+	if (!scenePath.empty() && !SceneFile::load(ofToDataPath(scenePath), renderObjects)) {
+		std::cerr << scenePath << " could not be opened for reading!\n";
+		status = SCENE_LOAD_FAILED;
+	}
+	float loadMs = elapsedMs(start);
+	// Lights saved in a binary scene light it rather than being drawn
+	std::vector<SceneObject *> objects;
+	for (SceneObject *obj : renderObjects) {
+		if (Light *light = dynamic_cast<Light *>(obj))
+			lights.push_back(light);
+		else
+			objects.push_back(obj);
+	}
+	renderObjects.swap(objects);
+
+	if (status == SUCCESS) {
+		Renderer renderer{ renderObjects, lights, ambientLight };
+		renderer.setParallel(parallel);
+		renderer.setPacketTracing(packets);
+		renderer.setResolution(width, height);
+		renderer.setRelaxedMarch(relaxedMarch);
+		if (marchSteps > 0)
+			renderer.setMarchStepBudget(marchSteps);
+		renderer.setBakedSDF(sdfCache);
+		renderer.setAntialiasing(aaSamples, aaThreshold);
+		renderer.setKeepSampleCounts(!sampleImagePath.empty());
+		renderer.setOutputDepth(depth);
+		renderer.getCamera().setWorldPosition(cameraPos);
+
+		start = Clock::now();
+		if (!renderer.render(imagePath, method))
+			status = IMAGE_SAVE_FAILED;
+		float renderMs = elapsedMs(start);
+
+		std::cout << "Scene: " << renderObjects.size() << " objects, " << lights.size() << " lights, loaded in " << loadMs << " ms\n"
+			<< "Render: " << width << "x" << height
+			<< (method == Renderer::RenderMethod::RAY_MARCH ? " ray march" : " ray trace")
+			<< (parallel ? " parallel" : " serial") << (packets ? " packets" : "") << " in " << renderMs << " ms\n";
+
+		Renderer::MemoryUsage memory = renderer.getMemoryUsage();
+		std::cout << "Memory: " << toMB(memory.total()) << " MB (framebuffer " << toMB(memory.framebuffer)
+			<< " MB, scene BVH " << toMB(memory.sceneBVH) << " MB, meshes " << toMB(memory.meshes) << " MB, SDF cache " << toMB(memory.sdfCache) << " MB)\n";
+
+		if (!sampleImagePath.empty()) {
+			ofPixels samples;
+			renderer.getSampleCountPixels(samples);
+			if (!ofSaveImage(samples, sampleImagePath))
+				std::cerr << sampleImagePath << " could not be saved!\n";
+		}
+
+		if (!statsPath.empty()) {
+			std::ofstream statsFile(ofToDataPath(statsPath));
+			statsFile << renderer.getStats().toJson();
+			if (!statsFile)
+				std::cerr << statsPath << " could not be written!\n";
+		}
+	}
+
+	// Children detach from their parent when it is deleted, so
+	// deleting in any order is safe.
+	for (SceneObject *obj : renderObjects)
+		delete obj;
+	for (Light *light : lights)
+		delete light;
+	delete ambientLight;
+	return status;
+}
@@ -0,0 +1,31 @@
+#ifndef HEADLESSRENDER_H
+#define HEADLESSRENDER_H
+
+// Command line rendering without a window or GL context.
+//
+// Usage: <app> --render <image> [--scene <file.so|file.sob>] [--camera x,y,z]
+//              [--light x,y,z,intensity]... [--size WxH] [--stats <file.json>]
+//              [--march] [--relaxed-march] [--march-steps N] [--serial] [--packets]
+//
+// The scene gets the same ground plane, key light and ambient light
+// that ofApp::setup creates, plus the objects in the scene file. Each
+// --light replaces the default key light; lights in a binary scene
+// are added to it. --size defaults to 600x400.
+// Timing and memory use are printed to stdout, --stats also writes
+// the render statistics as JSON.
+namespace HeadlessRender
+{
+	enum ExitCode
+	{
+		SUCCESS = 0,
+		BAD_ARGUMENTS = 1,
+		SCENE_LOAD_FAILED = 2,
+		IMAGE_SAVE_FAILED = 3,
+	};
+
+	// True if the arguments ask for a headless render
+	bool requested(int argc, char *argv[]);
+	int run(int argc, char *argv[]);
+}
+
+#endif
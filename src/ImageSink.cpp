@@ -0,0 +1,198 @@
+#include "ImageSink.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace
+{
+	std::string extensionOf(const std::string &filename)
+	{
+		size_t dot = filename.find_last_of('.');
+		if (dot == std::string::npos)
+			return "";
+		std::string ext = filename.substr(dot + 1);
+		std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+		return ext;
+	}
+
+	unsigned char to8(float v)
+	{
+		return static_cast<unsigned char>(glm::clamp(v, 0.0f, 1.0f) * 255 + 0.5f);
+	}
+
+	unsigned short to16(float v)
+	{
+		return static_cast<unsigned short>(glm::clamp(v, 0.0f, 1.0f) * 65535 + 0.5f);
+	}
+
+	bool isLittleEndian()
+	{
+		uint16_t probe = 1;
+		return *reinterpret_cast<unsigned char *>(&probe) == 1;
+	}
+}
+
+std::unique_ptr<ImageSink> ImageSink::create(const std::string &filename, ImageSink::Depth depth, ImageWriter *encoder)
+{
+	std::string ext = extensionOf(filename);
+	if (ext == "ppm")
+		return std::unique_ptr<ImageSink>(new PPMSink(filename, depth != DEPTH_8));
+	if (ext == "pfm")
+		return std::unique_ptr<ImageSink>(new PFMSink(filename));
+	if (ext == "png")
+		return std::unique_ptr<ImageSink>(new PNGSink(filename, depth != DEPTH_8, encoder));
+	return nullptr;
+}
+
+// PPMSink Functions
+//
+bool PPMSink::begin(int width, int height)
+{
+	file_m.open(filename_m, std::ios::binary);
+	width_m = width;
+	row_m.resize(static_cast<size_t>(width) * 3 * (wide_m ? 2 : 1));
+	file_m << "P6\n" << width << ' ' << height << '\n' << (wide_m ? 65535 : 255) << '\n';
+	return static_cast<bool>(file_m);
+}
+
+// 16 bit samples are stored most significant byte first
+bool PPMSink::writeRow(const float *rgb)
+{
+	for (int i = 0; i < width_m * 3; i++) {
+		if (wide_m) {
+			unsigned short v = to16(rgb[i]);
+			row_m[2 * i] = v >> 8;
+			row_m[2 * i + 1] = v & 0xff;
+		}
+		else row_m[i] = to8(rgb[i]);
+	}
+	file_m.write(reinterpret_cast<const char *>(row_m.data()), row_m.size());
+	return static_cast<bool>(file_m);
+}
+
+bool PPMSink::end()
+{
+	file_m.close();
+	return !file_m.fail();
+}
+
+// PFMSink Functions
+//
+bool PFMSink::begin(int width, int height)
+{
+	file_m.open(filename_m, std::ios::binary);
+	width_m = width;
+	// A negative scale means little endian
+	file_m << "PF\n" << width << ' ' << height << '\n' << (isLittleEndian() ? "-1.0" : "1.0") << '\n';
+	return static_cast<bool>(file_m);
+}
+
+bool PFMSink::writeRow(const float *rgb)
+{
+	file_m.write(reinterpret_cast<const char *>(rgb), static_cast<size_t>(width_m) * 3 * sizeof(float));
+	return static_cast<bool>(file_m);
+}
+
+bool PFMSink::end()
+{
+	file_m.close();
+	return !file_m.fail();
+}
+
+// PNGSink Functions
+//
+bool PNGSink::begin(int width, int height)
+{
+	width_m = width;
+	row_m = 0;
+	if (wide_m)
+		shortPixels_m.allocate(width, height, 3);
+	else
+		pixels_m.allocate(width, height, 3);
+	return true;
+}
+
+bool PNGSink::writeRow(const float *rgb)
+{
+	size_t offset = static_cast<size_t>(row_m++) * width_m * 3;
+	for (int i = 0; i < width_m * 3; i++) {
+		if (wide_m)
+			shortPixels_m.getData()[offset + i] = to16(rgb[i]);
+		else
+			pixels_m.getData()[offset + i] = to8(rgb[i]);
+	}
+	return true;
+}
+
+bool PNGSink::end()
+{
+	if (encoder_m) {
+		if (wide_m)
+			encoder_m->save(filename_m, shortPixels_m);
+		else
+			encoder_m->save(filename_m, pixels_m);
+		return true;
+	}
+	return wide_m ? ofSaveImage(shortPixels_m, filename_m) : ofSaveImage(pixels_m, filename_m);
+}
+
+// AsyncSink Functions
+//
+AsyncSink::~AsyncSink()
+{
+	if (thread_m.joinable())
+		end();
+}
+
+bool AsyncSink::begin(int width, int height)
+{
+	rowFloats_m = static_cast<size_t>(width) * 3;
+	if (!sink_m->begin(width, height))
+		return false;
+	done_m = false;
+	ok_m = true;
+	thread_m = std::thread(&AsyncSink::writerLoop, this);
+	return true;
+}
+
+// Returns false once the wrapped sink has failed, so the
+// caller can stop tracing rows that cannot be written
+bool AsyncSink::writeRow(const float *rgb)
+{
+	std::unique_lock<std::mutex> guard(lock_m);
+	rowCond_m.wait(guard, [this] { return rows_m.size() < maxRows_m; });
+	rows_m.push_back(std::vector<float>(rgb, rgb + rowFloats_m));
+	rowCond_m.notify_all();
+	return ok_m;
+}
+
+bool AsyncSink::end()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock_m);
+		done_m = true;
+	}
+	rowCond_m.notify_all();
+	if (thread_m.joinable())
+		thread_m.join();
+	bool ended = sink_m->end();
+	return ok_m && ended;
+}
+
+void AsyncSink::writerLoop()
+{
+	std::unique_lock<std::mutex> guard(lock_m);
+	while (true) {
+		rowCond_m.wait(guard, [this] { return done_m || !rows_m.empty(); });
+		if (rows_m.empty())
+			return;
+
+		std::vector<float> row = std::move(rows_m.front());
+		rows_m.pop_front();
+		rowCond_m.notify_all();
+		guard.unlock();
+		bool written = sink_m->writeRow(row.data());
+		guard.lock();
+		ok_m = ok_m && written;
+	}
+}
@@ -0,0 +1,133 @@
+#ifndef IMAGESINK_H
+#define IMAGESINK_H
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ofMain.h"
+#include "ImageWriter.h"
+
+// Destination for a rendered image that takes it one scanline at a
+// time, so the whole frame never has to be held in memory.
+//
+// begin() is called once with the image size, then writeRow() once
+// per row, top row first unless isBottomUp(), then end(). Rows are
+// RGB floats, three per pixel, nominally in [0, 1].
+class ImageSink
+{
+public:
+	// Bits per channel where the format offers a choice
+	enum Depth { DEPTH_8, DEPTH_16, DEPTH_FLOAT };
+
+	virtual ~ImageSink() {}
+
+	virtual bool begin(int width, int height) = 0;
+	virtual bool writeRow(const float *rgb) = 0;
+	// Returns false if anything could not be written
+	virtual bool end() = 0;
+	virtual bool isBottomUp() const { return false; }
+
+	// Sink for filename chosen by its extension: .ppm (8 or 16 bit),
+	// .pfm (float) or .png (8 or 16 bit). DEPTH_FLOAT falls back to
+	// 16 bit where floats are not supported. Returns null for any
+	// other extension. A PNG is encoded on encoder if one is given.
+	static std::unique_ptr<ImageSink> create(const std::string &filename, Depth depth, ImageWriter *encoder = NULL);
+};
+
+// Binary PPM (P6), written row by row as it arrives
+class PPMSink : public ImageSink
+{
+private:
+	std::string filename_m;
+	bool wide_m;
+	std::ofstream file_m;
+	int width_m = 0;
+	std::vector<unsigned char> row_m;
+
+public:
+	PPMSink(const std::string &filename, bool wide) : filename_m{ filename }, wide_m{ wide } {}
+
+	bool begin(int width, int height);
+	bool writeRow(const float *rgb);
+	bool end();
+};
+
+// Portable float map, bottom row first as the format stores it
+class PFMSink : public ImageSink
+{
+private:
+	std::string filename_m;
+	std::ofstream file_m;
+	int width_m = 0;
+
+public:
+	PFMSink(const std::string &filename) : filename_m{ filename } {}
+
+	bool begin(int width, int height);
+	bool writeRow(const float *rgb);
+	bool end();
+	bool isBottomUp() const { return true; }
+};
+
+// PNG has to be compressed as a whole, so rows are collected at 8 or
+// 16 bits per channel, a quarter or half of the float framebuffer,
+// and encoded in end(). With an encoder the PNG is compressed on its
+// thread and end() returns right away; check ImageWriter::finish().
+class PNGSink : public ImageSink
+{
+private:
+	std::string filename_m;
+	bool wide_m;
+	ImageWriter *encoder_m;
+	ofPixels pixels_m;
+	ofShortPixels shortPixels_m;
+	int width_m = 0;
+	int row_m = 0;
+
+public:
+	PNGSink(const std::string &filename, bool wide, ImageWriter *encoder = NULL) :
+		filename_m{ filename }, wide_m{ wide }, encoder_m{ encoder } {}
+
+	bool begin(int width, int height);
+	bool writeRow(const float *rgb);
+	bool end();
+};
+
+// Passes rows on to another sink from a background thread, so that
+// writing them out overlaps with tracing the next ones. At most
+// maxRows rows wait at once; writeRow() blocks beyond that.
+class AsyncSink : public ImageSink
+{
+private:
+	std::unique_ptr<ImageSink> sink_m;
+	size_t maxRows_m;
+	size_t rowFloats_m = 0;
+	std::deque<std::vector<float>> rows_m;
+	bool done_m = false;
+	bool ok_m = true;
+
+	std::mutex lock_m;
+	std::condition_variable rowCond_m;
+	std::thread thread_m;
+
+public:
+	AsyncSink(std::unique_ptr<ImageSink> sink, int maxRows = 256) :
+		sink_m{ std::move(sink) }, maxRows_m{ static_cast<size_t>(std::max(1, maxRows)) } {}
+	~AsyncSink();
+
+	bool begin(int width, int height);
+	bool writeRow(const float *rgb);
+	bool end();
+	bool isBottomUp() const { return sink_m->isBottomUp(); }
+
+private:
+	void writerLoop();
+};
+
+#endif
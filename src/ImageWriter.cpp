@@ -0,0 +1,70 @@
+#include "ImageWriter.h"
+
+ImageWriter::ImageWriter(int maxQueued) : maxQueued_m{ std::max(1, maxQueued) }
+{
+	thread_m = std::thread(&ImageWriter::writerLoop, this);
+}
+
+ImageWriter::~ImageWriter()
+{
+	finish();
+	{
+		std::lock_guard<std::mutex> guard(lock_m);
+		quit_m = true;
+	}
+	queueCond_m.notify_all();
+	thread_m.join();
+}
+
+void ImageWriter::save(const std::string &filename, const ofPixels &pixels)
+{
+	push(Job{ filename, pixels, ofShortPixels(), false });
+}
+
+void ImageWriter::save(const std::string &filename, const ofShortPixels &pixels)
+{
+	push(Job{ filename, ofPixels(), pixels, true });
+}
+
+void ImageWriter::push(Job &&job)
+{
+	std::unique_lock<std::mutex> guard(lock_m);
+	queueCond_m.wait(guard, [this] { return queue_m.size() < maxQueued_m; });
+	queue_m.push_back(std::move(job));
+	queueCond_m.notify_all();
+}
+
+int ImageWriter::finish()
+{
+	std::unique_lock<std::mutex> guard(lock_m);
+	queueCond_m.wait(guard, [this] { return queue_m.empty(); });
+	int failures = failures_m;
+	failures_m = 0;
+	return failures;
+}
+
+// The job stays at the front of the queue while it is written, so
+// finish() only returns once the last file is on disk.
+void ImageWriter::writerLoop()
+{
+	std::unique_lock<std::mutex> guard(lock_m);
+	while (true) {
+		queueCond_m.wait(guard, [this] { return quit_m || !queue_m.empty(); });
+		if (queue_m.empty())
+			return;
+
+		Job &job = queue_m.front();
+		guard.unlock();
+		bool saved = job.wide ? ofSaveImage(job.shortPixels, job.filename) : ofSaveImage(job.pixels, job.filename);
+		if (saved)
+			std::cout << "Image Saved to " << job.filename << ".\n";
+		else
+			std::cerr << job.filename << " could not be saved!\n";
+		guard.lock();
+
+		if (!saved)
+			failures_m++;
+		queue_m.pop_front();
+		queueCond_m.notify_all();
+	}
+}
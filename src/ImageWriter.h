@@ -0,0 +1,54 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "ofMain.h"
+
+// Encodes and saves images on a background thread so that tracing
+// the next frames overlaps with PNG compression and disk writes.
+// At most maxQueued images wait at once; save() blocks beyond that.
+class ImageWriter
+{
+private:
+	struct Job
+	{
+		std::string filename;
+		ofPixels pixels;
+		ofShortPixels shortPixels;
+		bool wide;	// 16 bits per channel, in shortPixels
+	};
+
+	std::deque<Job> queue_m;
+	int maxQueued_m;
+	int failures_m = 0;
+	bool quit_m = false;
+
+	std::mutex lock_m;
+	std::condition_variable queueCond_m;
+	std::thread thread_m;
+
+public:
+	ImageWriter(int maxQueued = 4);
+	~ImageWriter();
+
+	ImageWriter(const ImageWriter &) = delete;
+	ImageWriter &operator=(const ImageWriter &) = delete;
+
+	// Copies pixels, so the caller may reuse them right away
+	void save(const std::string &filename, const ofPixels &pixels);
+	void save(const std::string &filename, const ofShortPixels &pixels);
+	// Wait until every queued image is written.
+	// Returns the number of images that could not be saved.
+	int finish();
+
+private:
+	void push(Job &&job);
+	void writerLoop();
+};
+
+#endif
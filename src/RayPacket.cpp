@@ -0,0 +1,89 @@
+#include "RayPacket.h"
+
+namespace
+{
+	inline PacketFloat pmin(PacketFloat a, PacketFloat b) { return select(a < b, a, b); }
+	inline PacketFloat pmax(PacketFloat a, PacketFloat b) { return select(a > b, a, b); }
+
+	// Record lanes in mask as the new nearest hit at distance t. Only
+	// those lanes take t, so distance and object always change together.
+	void updateHit(PacketHit &hit, int mask, PacketFloat t, int obj, int prim)
+	{
+		alignas(32) float tLanes[PACKET_SIZE];
+		t.store(tLanes);
+		for (int i = 0; i < PACKET_SIZE; i++) {
+			if ((mask >> i) & 1) {
+				hit.t_m[i] = tLanes[i];
+				hit.obj_m[i] = obj;
+				hit.prim_m[i] = prim;
+			}
+		}
+	}
+}
+
+int PacketKernels::intersectBox(const RayPacket &packet, const PacketHit &hit, const AABB &box, int mask)
+{
+	PacketFloat t0 = PacketFloat::broadcast(0);
+	PacketFloat t1 = PacketFloat::load(hit.t_m);
+
+	const float *orig[3] = { packet.ox_m, packet.oy_m, packet.oz_m };
+	const float *invDir[3] = { packet.invDx_m, packet.invDy_m, packet.invDz_m };
+	for (int a = 0; a < 3; a++) {
+		PacketFloat o = PacketFloat::load(orig[a]);
+		PacketFloat inv = PacketFloat::load(invDir[a]);
+		PacketFloat tNear = (PacketFloat::broadcast(box.min_m[a]) - o) * inv;
+		PacketFloat tFar = (PacketFloat::broadcast(box.max_m[a]) - o) * inv;
+		t0 = pmax(t0, pmin(tNear, tFar));
+		t1 = pmin(t1, pmax(tNear, tFar));
+	}
+	return (t0 <= t1).bits() & mask;
+}
+
+void PacketKernels::intersectSphere(const RayPacket &packet, PacketHit &hit, int mask, const float *m, float radius, int obj, int prim)
+{
+	PacketFloat ox = PacketFloat::load(packet.ox_m), oy = PacketFloat::load(packet.oy_m), oz = PacketFloat::load(packet.oz_m);
+	PacketFloat dx = PacketFloat::load(packet.dx_m), dy = PacketFloat::load(packet.dy_m), dz = PacketFloat::load(packet.dz_m);
+	auto b = [](float f) { return PacketFloat::broadcast(f); };
+
+	// Origin and direction into object space
+	PacketFloat px = b(m[0]) * ox + b(m[4]) * oy + b(m[8]) * oz + b(m[12]);
+	PacketFloat py = b(m[1]) * ox + b(m[5]) * oy + b(m[9]) * oz + b(m[13]);
+	PacketFloat pz = b(m[2]) * ox + b(m[6]) * oy + b(m[10]) * oz + b(m[14]);
+	PacketFloat qx = b(m[0]) * dx + b(m[4]) * dy + b(m[8]) * dz;
+	PacketFloat qy = b(m[1]) * dx + b(m[5]) * dy + b(m[9]) * dz;
+	PacketFloat qz = b(m[2]) * dx + b(m[6]) * dy + b(m[10]) * dz;
+	PacketFloat len = sqrt(qx * qx + qy * qy + qz * qz);
+	qx = qx / len; qy = qy / len; qz = qz / len;
+
+	// diff = center - origin, center is the object space origin
+	PacketFloat zero = b(0);
+	PacketFloat diffX = zero - px, diffY = zero - py, diffZ = zero - pz;
+	PacketFloat t0 = diffX * qx + diffY * qy + diffZ * qz;
+	PacketFloat dSquared = diffX * diffX + diffY * diffY + diffZ * diffZ - t0 * t0;
+	PacketFloat r2 = b(radius * radius);
+	PacketFloat t1 = sqrt(r2 - dSquared);
+	PacketFloat eps = b(std::numeric_limits<float>::epsilon());
+	PacketFloat dist = select(t0 > t1 + eps, t0 - t1, t0 + t1);
+
+	// Back to a distance along the world ray
+	PacketFloat t = dist / len;
+	PacketMask laneMask = (dSquared <= r2) & (dist > eps) & (t < PacketFloat::load(hit.t_m));
+	int hits = laneMask.bits() & mask;
+	if (hits)
+		updateHit(hit, hits, t, obj, prim);
+}
+
+void PacketKernels::intersectPlane(const RayPacket &packet, PacketHit &hit, int mask, const glm::vec3 &point, const glm::vec3 &normal, int obj, int prim)
+{
+	PacketFloat ox = PacketFloat::load(packet.ox_m), oy = PacketFloat::load(packet.oy_m), oz = PacketFloat::load(packet.oz_m);
+	PacketFloat dx = PacketFloat::load(packet.dx_m), dy = PacketFloat::load(packet.dy_m), dz = PacketFloat::load(packet.dz_m);
+	auto b = [](float f) { return PacketFloat::broadcast(f); };
+	PacketFloat nx = b(normal.x), ny = b(normal.y), nz = b(normal.z);
+
+	PacketFloat d = dx * nx + dy * ny + dz * nz;
+	PacketFloat t = ((b(point.x) - ox) * nx + (b(point.y) - oy) * ny + (b(point.z) - oz) * nz) / d;
+	PacketMask laneMask = (b(std::numeric_limits<float>::epsilon()) < abs(d)) & (b(0) < t) & (t < PacketFloat::load(hit.t_m));
+	int hits = laneMask.bits() & mask;
+	if (hits)
+		updateHit(hit, hits, t, obj, prim);
+}
@@ -0,0 +1,169 @@
+#ifndef RAYPACKET_H
+#define RAYPACKET_H
+
+#include <cmath>
+#include <limits>
+
+#include "ofMain.h"
+#include "BVH.h"
+#include "Ray.h"
+
+// Packet width follows the widest vector unit the build targets:
+// 8 lanes with AVX, 4 with SSE. Define PACKET_SCALAR to force the
+// plain C++ lanes. All three run the same sequence of IEEE single
+// precision operations, so they produce identical results as long
+// as the compiler is not allowed to contract into FMAs.
+#if !defined(PACKET_SCALAR) && defined(__AVX__)
+#define PACKET_AVX
+#include <immintrin.h>
+#elif !defined(PACKET_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define PACKET_SSE
+#include <emmintrin.h>
+#endif
+
+#ifdef PACKET_AVX
+static const int PACKET_SIZE{ 8 };
+#else
+static const int PACKET_SIZE{ 4 };
+#endif
+
+static const int PACKET_ALL_LANES{ (1 << PACKET_SIZE) - 1 };
+
+// One float per lane
+struct PacketFloat
+{
+#if defined(PACKET_AVX)
+	__m256 v;
+	static PacketFloat load(const float *p) { return { _mm256_load_ps(p) }; }
+	static PacketFloat broadcast(float f) { return { _mm256_set1_ps(f) }; }
+	void store(float *p) const { _mm256_store_ps(p, v); }
+#elif defined(PACKET_SSE)
+	__m128 v;
+	static PacketFloat load(const float *p) { return { _mm_load_ps(p) }; }
+	static PacketFloat broadcast(float f) { return { _mm_set1_ps(f) }; }
+	void store(float *p) const { _mm_store_ps(p, v); }
+#else
+	float v[PACKET_SIZE];
+	static PacketFloat load(const float *p) { PacketFloat r; for (int i = 0; i < PACKET_SIZE; i++) r.v[i] = p[i]; return r; }
+	static PacketFloat broadcast(float f) { PacketFloat r; for (int i = 0; i < PACKET_SIZE; i++) r.v[i] = f; return r; }
+	void store(float *p) const { for (int i = 0; i < PACKET_SIZE; i++) p[i] = v[i]; }
+#endif
+};
+
+// Per-lane boolean, bits() packs it into the low PACKET_SIZE bits
+struct PacketMask
+{
+#if defined(PACKET_AVX)
+	__m256 v;
+	int bits() const { return _mm256_movemask_ps(v); }
+#elif defined(PACKET_SSE)
+	__m128 v;
+	int bits() const { return _mm_movemask_ps(v); }
+#else
+	int v;
+	int bits() const { return v; }
+#endif
+};
+
+#if defined(PACKET_AVX)
+inline PacketFloat operator+(PacketFloat a, PacketFloat b) { return { _mm256_add_ps(a.v, b.v) }; }
+inline PacketFloat operator-(PacketFloat a, PacketFloat b) { return { _mm256_sub_ps(a.v, b.v) }; }
+inline PacketFloat operator*(PacketFloat a, PacketFloat b) { return { _mm256_mul_ps(a.v, b.v) }; }
+inline PacketFloat operator/(PacketFloat a, PacketFloat b) { return { _mm256_div_ps(a.v, b.v) }; }
+inline PacketFloat sqrt(PacketFloat a) { return { _mm256_sqrt_ps(a.v) }; }
+inline PacketFloat abs(PacketFloat a) { return { _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v) }; }
+inline PacketMask operator<(PacketFloat a, PacketFloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+inline PacketMask operator>(PacketFloat a, PacketFloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+inline PacketMask operator<=(PacketFloat a, PacketFloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+inline PacketMask operator&(PacketMask a, PacketMask b) { return { _mm256_and_ps(a.v, b.v) }; }
+inline PacketFloat select(PacketMask m, PacketFloat a, PacketFloat b) { return { _mm256_blendv_ps(b.v, a.v, m.v) }; }
+#elif defined(PACKET_SSE)
+inline PacketFloat operator+(PacketFloat a, PacketFloat b) { return { _mm_add_ps(a.v, b.v) }; }
+inline PacketFloat operator-(PacketFloat a, PacketFloat b) { return { _mm_sub_ps(a.v, b.v) }; }
+inline PacketFloat operator*(PacketFloat a, PacketFloat b) { return { _mm_mul_ps(a.v, b.v) }; }
+inline PacketFloat operator/(PacketFloat a, PacketFloat b) { return { _mm_div_ps(a.v, b.v) }; }
+inline PacketFloat sqrt(PacketFloat a) { return { _mm_sqrt_ps(a.v) }; }
+inline PacketFloat abs(PacketFloat a) { return { _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v) }; }
+inline PacketMask operator<(PacketFloat a, PacketFloat b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+inline PacketMask operator>(PacketFloat a, PacketFloat b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+inline PacketMask operator<=(PacketFloat a, PacketFloat b) { return { _mm_cmple_ps(a.v, b.v) }; }
+inline PacketMask operator&(PacketMask a, PacketMask b) { return { _mm_and_ps(a.v, b.v) }; }
+inline PacketFloat select(PacketMask m, PacketFloat a, PacketFloat b) { return { _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)) }; }
+#else
+#define PACKET_LANEWISE(expr) for (int i = 0; i < PACKET_SIZE; i++) expr
+inline PacketFloat operator+(PacketFloat a, PacketFloat b) { PacketFloat r; PACKET_LANEWISE(r.v[i] = a.v[i] + b.v[i]); return r; }
+inline PacketFloat operator-(PacketFloat a, PacketFloat b) { PacketFloat r; PACKET_LANEWISE(r.v[i] = a.v[i] - b.v[i]); return r; }
+inline PacketFloat operator*(PacketFloat a, PacketFloat b) { PacketFloat r; PACKET_LANEWISE(r.v[i] = a.v[i] * b.v[i]); return r; }
+inline PacketFloat operator/(PacketFloat a, PacketFloat b) { PacketFloat r; PACKET_LANEWISE(r.v[i] = a.v[i] / b.v[i]); return r; }
+inline PacketFloat sqrt(PacketFloat a) { PacketFloat r; PACKET_LANEWISE(r.v[i] = std::sqrt(a.v[i])); return r; }
+inline PacketFloat abs(PacketFloat a) { PacketFloat r; PACKET_LANEWISE(r.v[i] = std::fabs(a.v[i])); return r; }
+inline PacketMask operator<(PacketFloat a, PacketFloat b) { PacketMask m{ 0 }; PACKET_LANEWISE(m.v |= (a.v[i] < b.v[i]) << i); return m; }
+inline PacketMask operator>(PacketFloat a, PacketFloat b) { PacketMask m{ 0 }; PACKET_LANEWISE(m.v |= (a.v[i] > b.v[i]) << i); return m; }
+inline PacketMask operator<=(PacketFloat a, PacketFloat b) { PacketMask m{ 0 }; PACKET_LANEWISE(m.v |= (a.v[i] <= b.v[i]) << i); return m; }
+inline PacketMask operator&(PacketMask a, PacketMask b) { return { a.v & b.v }; }
+inline PacketFloat select(PacketMask m, PacketFloat a, PacketFloat b) { PacketFloat r; PACKET_LANEWISE(r.v[i] = ((m.v >> i) & 1) ? a.v[i] : b.v[i]); return r; }
+#undef PACKET_LANEWISE
+#endif
+
+// Structure-of-arrays packet of world space rays with unit directions.
+// Lanes outside activeMask_m still hold a valid ray (a copy of a
+// real one) so that no kernel ever sees garbage.
+struct RayPacket
+{
+	alignas(32) float ox_m[PACKET_SIZE];
+	alignas(32) float oy_m[PACKET_SIZE];
+	alignas(32) float oz_m[PACKET_SIZE];
+	alignas(32) float dx_m[PACKET_SIZE];
+	alignas(32) float dy_m[PACKET_SIZE];
+	alignas(32) float dz_m[PACKET_SIZE];
+	alignas(32) float invDx_m[PACKET_SIZE];
+	alignas(32) float invDy_m[PACKET_SIZE];
+	alignas(32) float invDz_m[PACKET_SIZE];
+	int activeMask_m = 0;
+
+	void setRay(int lane, const Ray &ray)
+	{
+		glm::vec3 o = ray.getPosition(), d = ray.getDirection();
+		ox_m[lane] = o.x; oy_m[lane] = o.y; oz_m[lane] = o.z;
+		dx_m[lane] = d.x; dy_m[lane] = d.y; dz_m[lane] = d.z;
+		invDx_m[lane] = 1.0f / d.x; invDy_m[lane] = 1.0f / d.y; invDz_m[lane] = 1.0f / d.z;
+	}
+	Ray getRay(int lane) const
+	{
+		return Ray(glm::vec3(ox_m[lane], oy_m[lane], oz_m[lane]), glm::vec3(dx_m[lane], dy_m[lane], dz_m[lane]));
+	}
+};
+
+// Nearest hit per lane: distance along the ray, object index and the
+// caller's primitive index (both -1 on miss)
+struct PacketHit
+{
+	alignas(32) float t_m[PACKET_SIZE];
+	int obj_m[PACKET_SIZE];
+	int prim_m[PACKET_SIZE];
+
+	PacketHit()
+	{
+		for (int i = 0; i < PACKET_SIZE; i++) {
+			t_m[i] = std::numeric_limits<float>::max();
+			obj_m[i] = -1;
+			prim_m[i] = -1;
+		}
+	}
+};
+
+namespace PacketKernels
+{
+	// Lanes of mask whose ray enters box closer than their current hit
+	int intersectBox(const RayPacket &packet, const PacketHit &hit, const AABB &box, int mask);
+
+	// Sphere of radius centered at the origin of the space inverse
+	// (column major, 16 floats) maps world space into. Mirrors
+	// glm::intersectRaySphere.
+	void intersectSphere(const RayPacket &packet, PacketHit &hit, int mask, const float *inverse, float radius, int obj, int prim);
+
+	// Infinite plane through point with unit normal. Mirrors glm::intersectRayPlane.
+	void intersectPlane(const RayPacket &packet, PacketHit &hit, int mask, const glm::vec3 &point, const glm::vec3 &normal, int obj, int prim);
+}
+
+#endif
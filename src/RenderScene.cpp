@@ -0,0 +1,418 @@
+#include "RenderScene.h"
+#include "RenderStats.h"
+#include "SDFCache.h"
+
+#include <typeinfo>
+
+namespace
+{
+	RenderScene::Transform makeTransform(const glm::mat4 &matrix, const glm::mat4 &inverse)
+	{
+		RenderScene::Transform xf;
+		xf.matrix_m = matrix;
+		xf.inverse_m = inverse;
+		xf.normalMatrix_m = glm::transpose(glm::mat3(inverse));
+		return xf;
+	}
+
+	// Object space ray the same way SceneObject::intersect makes it
+	void toObject(const RenderScene::Transform &xf, const Ray &ray, glm::vec3 &p, glm::vec3 &d)
+	{
+		glm::vec4 p0 = xf.inverse_m * glm::vec4(ray.getPosition(), 1.0);
+		glm::vec4 p1 = xf.inverse_m * glm::vec4(ray.getPosition() + ray.getDirection(), 1.0);
+		p = glm::vec3(p0);
+		d = glm::normalize(glm::vec3(p1 - p0));
+	}
+
+	// Object space ray with a unit direction, as SceneObject::worldToObject
+	void toObjectScaled(const RenderScene::Transform &xf, const Ray &ray, glm::vec3 &p, glm::vec3 &d, float &tScale)
+	{
+		p = xf.inverse_m * glm::vec4(ray.getPosition(), 1.0);
+		d = xf.inverse_m * glm::vec4(ray.getDirection(), 0.0);
+		tScale = glm::length(d);
+		d /= tScale;
+	}
+
+	void toWorld(const RenderScene::Transform &xf, glm::vec3 &point, glm::vec3 &normal)
+	{
+		point = xf.matrix_m * glm::vec4(point, 1.0);
+		normal = glm::normalize(xf.normalMatrix_m * normal);
+	}
+
+	bool hitSphere(const RenderScene::SpherePrim &s, const Ray &ray, glm::vec3 &point, glm::vec3 &normal)
+	{
+		RENDER_STATS_ADD(INTERSECT_SPHERE, 1);
+		glm::vec3 p, d;
+		toObject(s.xf_m, ray, p, d);
+		if (!glm::intersectRaySphere(p, d, glm::vec3(0, 0, 0), s.radius_m, point, normal))
+			return false;
+		toWorld(s.xf_m, point, normal);
+		return true;
+	}
+
+	// Same math as Cone::intersect
+	bool hitCone(const RenderScene::ConePrim &c, const Ray &ray, glm::vec3 &point, glm::vec3 &normal)
+	{
+		RENDER_STATS_ADD(INTERSECT_CONE, 1);
+		glm::vec3 p, d;
+		toObject(c.xf_m, ray, p, d);
+
+		const glm::vec3 axis(0, 0, -1);
+		glm::vec3 vertex = (c.height_m / 2) * axis;
+		glm::vec3 oppVertex = (c.height_m / 2) * glm::vec3(0, 0, 1);
+
+		float DDotV = glm::dot(d, axis);
+		glm::vec3 COVector = p - vertex;
+		float CODotV = glm::dot(COVector, axis);
+
+		float a = (DDotV * DDotV) - c.cos2_m;
+		float b = 2 * ((DDotV * CODotV) - (glm::dot(d, COVector) * c.cos2_m));
+		float cc = (CODotV * CODotV) - (glm::dot(COVector, COVector) * c.cos2_m);
+
+		float determ = b * b - 4 * a * cc;
+		float t;
+		if (determ < 0)
+			return false;
+		else if (determ == 0)
+			t = (-b) / (2 * a);
+		else {
+			float t1 = (-b - glm::sqrt(determ)) / (2 * a);
+			float t2 = (-b + glm::sqrt(determ)) / (2 * a);
+			t = t1 < t2 ? t1 : t2;
+		}
+
+		point = Ray(p, d).evalPoint(t);
+		if (point.z < vertex.z)
+			return false;
+		if (point.z > oppVertex.z) {
+			glm::vec3 planeNorm(0, 0, 1);
+			if (!glm::intersectRayPlane(p, d, oppVertex, planeNorm, t))
+				return false;
+			point = Ray(p, d).evalPoint(t);
+			if (glm::length(((point - oppVertex) * (point - oppVertex))) > (c.radius_m * c.radius_m))
+				return false;
+			normal = planeNorm;
+		}
+		else {
+			float xNorm = point.x - vertex.x;
+			float yNorm = point.y - vertex.y;
+			float zNorm = glm::length(glm::vec2(xNorm, yNorm)) * c.tanTheta_m;
+			normal = glm::normalize(glm::vec3(xNorm, yNorm, zNorm));
+		}
+		toWorld(c.xf_m, point, normal);
+		return true;
+	}
+
+	bool hitMesh(const RenderScene::MeshPrim &m, const Ray &ray, glm::vec3 &point, glm::vec3 &normal)
+	{
+		RENDER_STATS_ADD(INTERSECT_MESH, 1);
+		glm::vec3 orig, d;
+		toObject(m.xf_m, ray, orig, d);
+
+		const TriangleBuffer &tris = *m.tris_m;
+		float nearestDist = FLT_MAX;
+		int nearestTri = -1;
+		int triTests = 0;
+		m.bvh_m->traverse(orig, d, nearestDist, [&](int i, float &tMax) {
+			float dist;
+			triTests++;
+			if (tris.intersect(i, orig, d, dist) && dist < tMax) {
+				tMax = dist;
+				nearestTri = i;
+				return true;
+			}
+			return false;
+		});
+		RENDER_STATS_ADD(TRIANGLE_TESTS, triTests);
+
+		if (nearestTri < 0)
+			return false;
+		normal = tris.getNormal(nearestTri);
+		point = orig + d * nearestDist;
+		toWorld(m.xf_m, point, normal);
+		return true;
+	}
+
+	bool hitPlane(const RenderScene::PlanePrim &pl, const Ray &ray, float &dist)
+	{
+		RENDER_STATS_ADD(INTERSECT_PLANE, 1);
+		return glm::intersectRayPlane(ray.getPosition(), ray.getDirection(), pl.point_m, pl.normal_m, dist);
+	}
+}
+
+void RenderScene::compile(const std::vector<SceneObject *> &objs)
+{
+	prims_m.clear();
+	spheres_m.clear();
+	planes_m.clear();
+	cones_m.clear();
+	meshes_m.clear();
+	others_m.clear();
+
+	auto addSphere = [&](const glm::mat4 &matrix, const glm::mat4 &inverse, float radius, int object) {
+		prims_m.push_back({ SPHERE, static_cast<int>(spheres_m.size()), object });
+		spheres_m.push_back({ makeTransform(matrix, inverse), radius, object });
+	};
+	auto addCone = [&](const glm::mat4 &matrix, const glm::mat4 &inverse, float radius, float height, int object) {
+		float theta = glm::atan(radius / height);
+		prims_m.push_back({ CONE, static_cast<int>(cones_m.size()), object });
+		cones_m.push_back({ makeTransform(matrix, inverse), radius, height, glm::cos(theta) * glm::cos(theta), glm::tan(theta), object });
+	};
+
+	// Exact types only, a subclass may intersect differently
+	for (int i = 0; i < objs.size(); i++) {
+		SceneObject *obj = objs[i];
+		const std::type_info &type = typeid(*obj);
+		if (type == typeid(Sphere)) {
+			const Sphere *sphere = static_cast<const Sphere *>(obj);
+			addSphere(sphere->getMatrix(), sphere->getInverseMatrix(), sphere->getRadius(), i);
+		}
+		else if (type == typeid(Plane)) {
+			const Plane *plane = static_cast<const Plane *>(obj);
+			planes_m.push_back({ plane->getWorldPosition(), plane->getNormal(), i, static_cast<int>(prims_m.size()) });
+			prims_m.push_back({ PLANE, static_cast<int>(planes_m.size()) - 1, i });
+		}
+		else if (type == typeid(Cone)) {
+			const Cone *cone = static_cast<const Cone *>(obj);
+			addCone(cone->getMatrix(), cone->getInverseMatrix(), cone->getRadius(), cone->getHeight(), i);
+		}
+		else if (type == typeid(Mesh)) {
+			const Mesh *mesh = static_cast<const Mesh *>(obj);
+			prims_m.push_back({ MESH, static_cast<int>(meshes_m.size()), i });
+			meshes_m.push_back({ makeTransform(mesh->getMatrix(), mesh->getInverseMatrix()), &mesh->getTriangles(), &mesh->getBVH(), i });
+		}
+		else if (type == typeid(Joint)) {
+			// Node and connector matrices are relative to the joint
+			const Joint *joint = static_cast<const Joint *>(obj);
+			const Sphere &node = joint->getNode();
+			addSphere(joint->getMatrix() * node.getMatrix(), node.getInverseMatrix() * joint->getInverseMatrix(), node.getRadius(), i);
+			if (joint->hasParent()) {
+				const Cone &conn = joint->getConnector();
+				addCone(joint->getMatrix() * conn.getMatrix(), conn.getInverseMatrix() * joint->getInverseMatrix(), conn.getRadius(), conn.getHeight(), i);
+			}
+		}
+		else {
+			prims_m.push_back({ OTHER, static_cast<int>(others_m.size()), i });
+			others_m.push_back(obj);
+		}
+	}
+}
+
+AABB RenderScene::getWorldBounds(int prim) const
+{
+	const PrimRef &ref = prims_m[prim];
+	AABB bounds;
+	switch (ref.kind_m)
+	{
+	case SPHERE: {
+		const SpherePrim &s = spheres_m[ref.slot_m];
+		bounds.grow(glm::vec3(-s.radius_m));
+		bounds.grow(glm::vec3(s.radius_m));
+		return bounds.transformed(s.xf_m.matrix_m);
+	}
+	case CONE: {
+		const ConePrim &c = cones_m[ref.slot_m];
+		bounds.grow(glm::vec3(-c.radius_m, -c.radius_m, -c.height_m / 2));
+		bounds.grow(glm::vec3(c.radius_m, c.radius_m, c.height_m / 2));
+		return bounds.transformed(c.xf_m.matrix_m);
+	}
+	case MESH: {
+		const MeshPrim &m = meshes_m[ref.slot_m];
+		return m.bvh_m->empty() ? bounds : m.bvh_m->getNodes()[0].bounds_m.transformed(m.xf_m.matrix_m);
+	}
+	case OTHER:
+		return others_m[ref.slot_m]->getWorldBounds();
+	default:
+		return bounds;
+	}
+}
+
+size_t RenderScene::getMemoryUsage() const
+{
+	return prims_m.capacity() * sizeof(PrimRef)
+		+ spheres_m.capacity() * sizeof(SpherePrim)
+		+ planes_m.capacity() * sizeof(PlanePrim)
+		+ cones_m.capacity() * sizeof(ConePrim)
+		+ meshes_m.capacity() * sizeof(MeshPrim)
+		+ others_m.capacity() * sizeof(SceneObject *);
+}
+
+// Field by field, since struct padding holds no data
+uint64_t RenderScene::hashPrim(int prim, uint64_t h) const
+{
+	const PrimRef &ref = prims_m[prim];
+	h = SDFCache::hash(h, &ref.kind_m, sizeof(ref.kind_m));
+	switch (ref.kind_m)
+	{
+	case SPHERE: {
+		const SpherePrim &s = spheres_m[ref.slot_m];
+		h = SDFCache::hash(h, &s.xf_m.matrix_m, sizeof(glm::mat4));
+		h = SDFCache::hash(h, &s.radius_m, sizeof(float));
+		break;
+	}
+	case PLANE: {
+		const PlanePrim &pl = planes_m[ref.slot_m];
+		h = SDFCache::hash(h, &pl.point_m, sizeof(glm::vec3));
+		h = SDFCache::hash(h, &pl.normal_m, sizeof(glm::vec3));
+		break;
+	}
+	case CONE: {
+		const ConePrim &c = cones_m[ref.slot_m];
+		h = SDFCache::hash(h, &c.xf_m.matrix_m, sizeof(glm::mat4));
+		h = SDFCache::hash(h, &c.radius_m, sizeof(float));
+		h = SDFCache::hash(h, &c.height_m, sizeof(float));
+		break;
+	}
+	case MESH: {
+		const MeshPrim &m = meshes_m[ref.slot_m];
+		h = SDFCache::hash(h, &m.xf_m.matrix_m, sizeof(glm::mat4));
+		h = SDFCache::hash(h, &m.tris_m, sizeof(m.tris_m));
+		break;
+	}
+	case OTHER: {
+		// Only the transform and bounds are visible from here
+		const SceneObject *obj = others_m[ref.slot_m];
+		AABB bounds = obj->getWorldBounds();
+		h = SDFCache::hash(h, &obj->getMatrix(), sizeof(glm::mat4));
+		h = SDFCache::hash(h, &bounds.min_m, sizeof(glm::vec3));
+		h = SDFCache::hash(h, &bounds.max_m, sizeof(glm::vec3));
+		break;
+	}
+	}
+	return h;
+}
+
+bool RenderScene::intersect(int prim, const Ray &ray, float &dist, glm::vec3 &point, glm::vec3 &normal) const
+{
+	const PrimRef &ref = prims_m[prim];
+	bool hit = false;
+	switch (ref.kind_m)
+	{
+	case SPHERE:
+		hit = hitSphere(spheres_m[ref.slot_m], ray, point, normal);
+		break;
+	case PLANE: {
+		const PlanePrim &pl = planes_m[ref.slot_m];
+		hit = hitPlane(pl, ray, dist);
+		if (hit) {
+			point = ray.evalPoint(dist);
+			normal = pl.normal_m;
+		}
+		break;
+	}
+	case CONE:
+		hit = hitCone(cones_m[ref.slot_m], ray, point, normal);
+		break;
+	case MESH:
+		hit = hitMesh(meshes_m[ref.slot_m], ray, point, normal);
+		break;
+	case OTHER:
+		hit = others_m[ref.slot_m]->intersect(ray, point, normal);
+		break;
+	}
+	if (hit)
+		dist = glm::length(point - ray.getPosition());
+	return hit;
+}
+
+bool RenderScene::hitAt(int prim, const Ray &ray, float dist, glm::vec3 &point, glm::vec3 &normal) const
+{
+	const PrimRef &ref = prims_m[prim];
+	switch (ref.kind_m)
+	{
+	case SPHERE: {
+		// The object space normal of a sphere at the origin is its point
+		const SpherePrim &s = spheres_m[ref.slot_m];
+		point = ray.evalPoint(dist);
+		glm::vec3 local = s.xf_m.inverse_m * glm::vec4(point, 1.0);
+		normal = glm::normalize(s.xf_m.normalMatrix_m * (local / s.radius_m));
+		return true;
+	}
+	case PLANE:
+		point = ray.evalPoint(dist);
+		normal = planes_m[ref.slot_m].normal_m;
+		return true;
+	default: {
+		float again;
+		return intersect(prim, ray, again, point, normal);
+	}
+	}
+}
+
+bool RenderScene::occluded(int prim, const Ray &ray, float tMax) const
+{
+	const PrimRef &ref = prims_m[prim];
+	switch (ref.kind_m)
+	{
+	case SPHERE: {
+		RENDER_STATS_ADD(OCCLUDED_TESTS, 1);
+		const SpherePrim &s = spheres_m[ref.slot_m];
+		glm::vec3 p, d;
+		float tScale, dist;
+		toObjectScaled(s.xf_m, ray, p, d, tScale);
+		return glm::intersectRaySphere(p, d, glm::vec3(0, 0, 0), s.radius_m * s.radius_m, dist) && !(dist > tMax * tScale);
+	}
+	case PLANE: {
+		RENDER_STATS_ADD(OCCLUDED_TESTS, 1);
+		float dist;
+		return glm::intersectRayPlane(ray.getPosition(), ray.getDirection(), planes_m[ref.slot_m].point_m, planes_m[ref.slot_m].normal_m, dist) && !(dist > tMax);
+	}
+	case MESH: {
+		RENDER_STATS_ADD(OCCLUDED_TESTS, 1);
+		const MeshPrim &m = meshes_m[ref.slot_m];
+		glm::vec3 orig, d;
+		float tScale;
+		toObjectScaled(m.xf_m, ray, orig, d, tScale);
+		float objMax = tMax * tScale;
+		const TriangleBuffer &tris = *m.tris_m;
+		int triTests = 0;
+		bool hit = m.bvh_m->traverseAny(orig, d, objMax, [&](int i) {
+			float dist;
+			triTests++;
+			return tris.intersect(i, orig, d, dist) && !(dist > objMax);
+		});
+		RENDER_STATS_ADD(TRIANGLE_TESTS, triTests);
+		return hit;
+	}
+	case OTHER:
+		return others_m[ref.slot_m]->occluded(ray, tMax);
+	default: {
+		// Cones have no cheaper any-hit test
+		RENDER_STATS_ADD(OCCLUDED_TESTS, 1);
+		float dist;
+		glm::vec3 point, normal;
+		return intersect(prim, ray, dist, point, normal) && !(dist > tMax);
+	}
+	}
+}
+
+bool RenderScene::intersectPlanes(const Ray &ray, float &tMax, int &object, glm::vec3 &point, glm::vec3 &normal) const
+{
+	bool hit = false;
+	for (const PlanePrim &pl : planes_m) {
+		float t;
+		if (!hitPlane(pl, ray, t))
+			continue;
+		glm::vec3 planePoint = ray.evalPoint(t);
+		float dist = glm::length(planePoint - ray.getPosition());
+		if (tMax > dist) {
+			tMax = dist;
+			object = pl.object_m;
+			point = planePoint;
+			normal = pl.normal_m;
+			hit = true;
+		}
+	}
+	return hit;
+}
+
+bool RenderScene::occludedPlanes(const Ray &ray, float tMax, int skip) const
+{
+	for (const PlanePrim &pl : planes_m) {
+		RENDER_STATS_ADD(OCCLUDED_TESTS, 1);
+		float dist;
+		if (pl.object_m != skip && glm::intersectRayPlane(ray.getPosition(), ray.getDirection(), pl.point_m, pl.normal_m, dist) && !(dist > tMax))
+			return true;
+	}
+	return false;
+}
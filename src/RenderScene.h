@@ -0,0 +1,113 @@
+#ifndef RENDERSCENE_H
+#define RENDERSCENE_H
+
+#include <vector>
+
+#include "ofMain.h"
+#include "BVH.h"
+#include "Ray.h"
+#include "SceneObject.h"
+#include "TriangleBuffer.h"
+
+// Flat copy of a scene for the intersection hot loops.
+//
+// compile() copies the world transforms and shape parameters of every
+// object into one contiguous array per primitive type, so testing a ray
+// takes no virtual call and never touches the SceneObjects. Joints are
+// expanded into their node sphere and connector cone. Every primitive
+// keeps the index of the object it came from, which is what hits
+// report. Objects of any other type are still tested through
+// SceneObject.
+class RenderScene
+{
+public:
+	enum Kind : unsigned char { SPHERE, PLANE, CONE, MESH, OTHER };
+
+	// Which array a primitive is in, and where
+	struct PrimRef
+	{
+		Kind kind_m;
+		int slot_m;
+		int object_m;
+	};
+
+	// World matrix, its inverse and the inverse transpose for normals
+	struct Transform
+	{
+		glm::mat4 matrix_m;
+		glm::mat4 inverse_m;
+		glm::mat3 normalMatrix_m;
+	};
+
+	struct SpherePrim
+	{
+		Transform xf_m;
+		float radius_m;
+		int object_m;
+	};
+
+	struct PlanePrim
+	{
+		glm::vec3 point_m;
+		glm::vec3 normal_m;
+		int object_m;
+		int prim_m;			// index in the primitive list
+	};
+
+	// Along the object's z axis, apex at -height / 2
+	struct ConePrim
+	{
+		Transform xf_m;
+		float radius_m;
+		float height_m;
+		float cos2_m;		// of the half angle
+		float tanTheta_m;
+		int object_m;
+	};
+
+	struct MeshPrim
+	{
+		Transform xf_m;
+		const TriangleBuffer *tris_m;
+		const BVH *bvh_m;
+		int object_m;
+	};
+
+private:
+	std::vector<PrimRef> prims_m;
+	std::vector<SpherePrim> spheres_m;
+	std::vector<PlanePrim> planes_m;
+	std::vector<ConePrim> cones_m;
+	std::vector<MeshPrim> meshes_m;
+	std::vector<SceneObject *> others_m;
+
+public:
+	// Objects must have their matrices cached (SceneObject::updateMatrices)
+	void compile(const std::vector<SceneObject *> &objs);
+
+	int size() const { return static_cast<int>(prims_m.size()); }
+	const PrimRef& getPrim(int prim) const { return prims_m[prim]; }
+	const SpherePrim& getSphere(int slot) const { return spheres_m[slot]; }
+	const std::vector<PlanePrim>& getPlanes() const { return planes_m; }
+	// Invalid for unbounded primitives
+	AABB getWorldBounds(int prim) const;
+	size_t getMemoryUsage() const;
+	// Folds into h everything a primitive's hits depend on, to tell
+	// whether it changed between two compiles
+	uint64_t hashPrim(int prim, uint64_t h) const;
+
+	// dist is the distance from the ray origin to the world space point
+	bool intersect(int prim, const Ray &ray, float &dist, glm::vec3 &point, glm::vec3 &normal) const;
+	// Point and normal of a hit already found at distance dist along
+	// ray (unit direction). Spheres and planes are rebuilt from dist,
+	// other primitives are intersected again.
+	bool hitAt(int prim, const Ray &ray, float dist, glm::vec3 &point, glm::vec3 &normal) const;
+	bool occluded(int prim, const Ray &ray, float tMax) const;
+
+	// Planes are unbounded, so every ray is tested against all of them.
+	// Updates tMax, object, point and normal if one is hit closer.
+	bool intersectPlanes(const Ray &ray, float &tMax, int &object, glm::vec3 &point, glm::vec3 &normal) const;
+	bool occludedPlanes(const Ray &ray, float tMax, int skip) const;
+};
+
+#endif
@@ -0,0 +1,136 @@
+#include "RenderStats.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+
+namespace
+{
+	const char *names[RenderStats::COUNTER_COUNT] = {
+		"primary_rays",
+		"shadow_rays",
+		"intersect_light",
+		"intersect_plane",
+		"intersect_sphere",
+		"intersect_cone",
+		"intersect_mesh",
+		"intersect_joint",
+		"occluded_tests",
+		"packet_tests",
+		"triangle_tests",
+		"march_steps",
+		"sdf_evals",
+		"matrix_inversions",
+		"tiles_traced",
+		"tiles_total",
+	};
+
+	// Live thread blocks, plus the totals of threads that have exited
+	std::mutex &registryLock()
+	{
+		static std::mutex lock;
+		return lock;
+	}
+
+	std::vector<RenderStats::ThreadCounters *> &registry()
+	{
+		static std::vector<RenderStats::ThreadCounters *> threads;
+		return threads;
+	}
+
+	RenderStats::Counters &retired()
+	{
+		static RenderStats::Counters counters;
+		return counters;
+	}
+}
+
+const char *RenderStats::getName(Counter counter)
+{
+	return names[counter];
+}
+
+RenderStats::ThreadCounters::ThreadCounters()
+{
+	for (std::atomic<uint64_t> &value : values)
+		value.store(0, std::memory_order_relaxed);
+	std::lock_guard<std::mutex> guard(registryLock());
+	registry().push_back(this);
+}
+
+RenderStats::ThreadCounters::~ThreadCounters()
+{
+	std::lock_guard<std::mutex> guard(registryLock());
+	for (int i = 0; i < COUNTER_COUNT; i++)
+		retired().values[i] += values[i].load(std::memory_order_relaxed);
+	std::vector<ThreadCounters *> &threads = registry();
+	threads.erase(std::remove(threads.begin(), threads.end(), this), threads.end());
+}
+
+void RenderStats::reset()
+{
+	std::lock_guard<std::mutex> guard(registryLock());
+	for (ThreadCounters *thread : registry()) {
+		for (std::atomic<uint64_t> &value : thread->values)
+			value.store(0, std::memory_order_relaxed);
+	}
+	retired() = Counters();
+}
+
+RenderStats::Counters RenderStats::collect()
+{
+	std::lock_guard<std::mutex> guard(registryLock());
+	Counters total = retired();
+	for (ThreadCounters *thread : registry()) {
+		for (int i = 0; i < COUNTER_COUNT; i++)
+			total.values[i] += thread->values[i].load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+double RenderStats::Summary::getRaysPerSecond() const
+{
+	if (wallMs <= 0)
+		return 0;
+	return (counters[PRIMARY_RAYS] + counters[SHADOW_RAYS]) / (wallMs / 1000.0);
+}
+
+std::string RenderStats::Summary::toText() const
+{
+	std::stringstream text;
+	text << "Render stats: " << width << "x" << height << " " << method << " in " << wallMs << " ms\n";
+	for (const std::pair<std::string, float> &phase : phasesMs)
+		text << "  " << std::left << std::setw(20) << phase.first << phase.second << " ms\n";
+#if RENDER_STATS
+	for (int i = 0; i < COUNTER_COUNT; i++) {
+		if (counters.values[i])
+			text << "  " << std::left << std::setw(20) << names[i] << counters.values[i] << '\n';
+	}
+	text << "  " << std::left << std::setw(20) << "rays_per_sec" << static_cast<uint64_t>(getRaysPerSecond()) << '\n';
+#endif
+	return text.str();
+}
+
+std::string RenderStats::Summary::toJson() const
+{
+	std::stringstream json;
+	json << "{\n"
+		<< "  \"width\": " << width << ",\n"
+		<< "  \"height\": " << height << ",\n"
+		<< "  \"method\": \"" << method << "\",\n"
+		<< "  \"wall_ms\": " << wallMs << ",\n"
+		<< "  \"phases_ms\": {";
+	for (int i = 0; i < phasesMs.size(); i++)
+		json << (i ? ", " : " ") << '"' << phasesMs[i].first << "\": " << phasesMs[i].second;
+	json << " }";
+#if RENDER_STATS
+	json << ",\n  \"rays_per_sec\": " << static_cast<uint64_t>(getRaysPerSecond())
+		<< ",\n  \"counters\": {";
+	for (int i = 0; i < COUNTER_COUNT; i++)
+		json << (i ? ",\n    " : "\n    ") << '"' << names[i] << "\": " << counters.values[i];
+	json << "\n  }";
+#endif
+	json << "\n}\n";
+	return json.str();
+}
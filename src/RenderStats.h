@@ -0,0 +1,101 @@
+#ifndef RENDERSTATS_H
+#define RENDERSTATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Build with RENDER_STATS=0 to compile every counter out
+#ifndef RENDER_STATS
+#define RENDER_STATS 1
+#endif
+
+// Hot path counters for the renderer.
+//
+// Each thread bumps its own block of counters, so counting costs a
+// thread local add and never contends. collect() sums the blocks of
+// all threads, including threads that have since exited.
+namespace RenderStats
+{
+	enum Counter
+	{
+		PRIMARY_RAYS,
+		SHADOW_RAYS,
+		INTERSECT_LIGHT,
+		INTERSECT_PLANE,
+		INTERSECT_SPHERE,
+		INTERSECT_CONE,
+		INTERSECT_MESH,
+		INTERSECT_JOINT,
+		OCCLUDED_TESTS,
+		PACKET_TESTS,
+		TRIANGLE_TESTS,
+		MARCH_STEPS,
+		SDF_EVALS,
+		MATRIX_INVERSIONS,
+		TILES_TRACED,		// of TILES_TOTAL, fewer when rendering incrementally
+		TILES_TOTAL,
+		COUNTER_COUNT
+	};
+
+	// snake_case name, used as the JSON key
+	const char *getName(Counter counter);
+
+	struct Counters
+	{
+		uint64_t values[COUNTER_COUNT] = {};
+		uint64_t operator[](Counter counter) const { return values[counter]; }
+	};
+
+	// Written only by the owning thread, read by collect(). Relaxed
+	// atomics keep that well defined at the cost of a plain add.
+	struct ThreadCounters
+	{
+		std::atomic<uint64_t> values[COUNTER_COUNT];
+
+		ThreadCounters();
+		~ThreadCounters();
+	};
+
+	inline ThreadCounters &local()
+	{
+		static thread_local ThreadCounters counters;
+		return counters;
+	}
+
+	inline void add(Counter counter, uint64_t n)
+	{
+		std::atomic<uint64_t> &value = local().values[counter];
+		value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	// Only call these while no thread is counting
+	void reset();
+	Counters collect();
+
+	// What render() reports
+	struct Summary
+	{
+		int width = 0;
+		int height = 0;
+		std::string method;
+		float wallMs = 0;
+		std::vector<std::pair<std::string, float>> phasesMs;
+		Counters counters;
+
+		// Primary plus shadow rays per second of wall time
+		double getRaysPerSecond() const;
+		std::string toText() const;
+		std::string toJson() const;
+	};
+}
+
+#if RENDER_STATS
+#define RENDER_STATS_ADD(counter, n) RenderStats::add(RenderStats::counter, n)
+#else
+#define RENDER_STATS_ADD(counter, n) ((void)0)
+#endif
+
+#endif
@@ -1,68 +1,705 @@
 #include "Renderer.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <set>
+#include <sstream>
+#include <typeinfo>
+
 const float Renderer::DIST_THRESHOLD = 0.1f;
+const float Renderer::NORMAL_EPSILON = 0.01f;
 const float Renderer::MAX_DISTANCE = 10.0f;
+const float Renderer::MARCH_RELAXATION = 1.6f;
+const float Renderer::SDF_CACHE_VOXEL = 0.1f;
+const float Renderer::DEFAULT_AA_THRESHOLD = 0.1f;
+const float Renderer::SHADOW_BIAS = 0.1f;
+
+thread_local Renderer::TileDeps *Renderer::recording_t = nullptr;
+
+namespace
+{
+	// Integer hash (Wellons' lowbias32) mapped to [0, 1), so that the
+	// jitter of a sample is the same on every run and every thread
+	float hashToUnit(uint32_t x)
+	{
+		x ^= x >> 16;
+		x *= 0x7feb352du;
+		x ^= x >> 15;
+		x *= 0x846ca68bu;
+		x ^= x >> 16;
+		return (x >> 8) * (1.0f / 16777216.0f);
+	}
+}
+
+bool Renderer::render(std::string filename, Renderer::RenderMethod rend) {
+	typedef std::chrono::steady_clock Clock;
+	auto elapsedMs = [](Clock::time_point from, Clock::time_point to) {
+		return std::chrono::duration<float, std::milli>(to - from).count();
+	};
 
-void Renderer::render(std::string filename, Renderer::RenderMethod rend) {
 	std::cout << "Saving Image to " << filename << "...\n";
-	image_m.allocate(imageWidth, imageHeight, OF_IMAGE_COLOR);
-	for (int w = 0; w < imageWidth; w++) {
-		for (int h = 0; h < imageHeight; h++) {
-			float u = (w + 0.5) / imageWidth;
-			float v = (h + 0.5) / imageHeight;
-
-			Ray ray = renderCam_m.getRay(u, v);
-
-			glm::vec3 nearestPoint;
-			glm::vec3 nearestNorm;
-			nearestObj_m = -1;
-			bool hit;
-
-			switch (rend)
-			{
-			// Ray Trace Algorithm
-			case Renderer::RenderMethod::RAY_TRACE:
-				hit = rayTraceHit(ray, nearestPoint, nearestNorm);
-				break;
-
-			// Ray March Algorithm
-			case Renderer::RenderMethod::RAY_MARCH:
-				hit = rayMarchHit(ray, nearestPoint, nearestNorm);
-				break;
+	RenderStats::reset();
+	stats_m = RenderStats::Summary();
+	Clock::time_point start = Clock::now();
+	bool saved;
+	std::unique_ptr<ImageSink> sink = ImageSink::create(filename, outputDepth_m);
+	if (sink) {
+		// Rows are written while later bands are traced, so the
+		// two can't be timed apart
+		AsyncSink async(std::move(sink));
+		saved = renderToSink(async, rend);
+		stats_m.phasesMs.push_back(std::make_pair("trace+save", elapsedMs(start, Clock::now())));
+	}
+	else {
+		beginFrame();
+		Clock::time_point prepared = Clock::now();
+		traceFrame(rend);
+		Clock::time_point traced = Clock::now();
+
+		ofPixels pixels;
+		getPixels(pixels);
+		saved = ofSaveImage(pixels, filename);
+		stats_m.phasesMs.push_back(std::make_pair("prepare", elapsedMs(start, prepared)));
+		stats_m.phasesMs.push_back(std::make_pair("trace", elapsedMs(prepared, traced)));
+		stats_m.phasesMs.push_back(std::make_pair("save", elapsedMs(traced, Clock::now())));
+	}
+	Clock::time_point end = Clock::now();
+
+	stats_m.width = width_m;
+	stats_m.height = height_m;
+	stats_m.method = rend == Renderer::RenderMethod::RAY_MARCH ? "ray_march" : "ray_trace";
+	stats_m.wallMs = elapsedMs(start, end);
+	stats_m.counters = RenderStats::collect();
+	std::cout << stats_m.toText();
+
+	if (!saved) {
+		std::cerr << filename << " could not be saved!\n";
+		return false;
+	}
+	std::cout << "Image Saved.\n";
+	return true;
+}
+
+void Renderer::renderFrame(Renderer::RenderMethod rend) {
+	beginFrame();
+	traceFrame(rend);
+}
+
+bool Renderer::renderToSink(ImageSink &sink, Renderer::RenderMethod rend) {
+	cancel_m = false;
+	// Without anti-aliasing every count is one, so none are stored
+	if (keepSampleCounts_m && aaGrid_m > 1)
+		sampleCounts_m.assign(static_cast<size_t>(width_m) * height_m, 1);
+	else
+		std::vector<unsigned short>().swap(sampleCounts_m);
+	prepareScene();
+	if (!sink.begin(width_m, height_m))
+		return false;
+
+	// Bands go top down, or bottom up if that is the order the sink takes rows in
+	bool bottomUp = sink.isBottomUp();
+	bool ok = true;
+	for (int band = 0; band * TILE_SIZE < height_m && ok; band++) {
+		int h0 = bottomUp ? band * TILE_SIZE : std::max(0, height_m - (band + 1) * TILE_SIZE);
+		int h1 = bottomUp ? std::min(height_m, (band + 1) * TILE_SIZE) : height_m - band * TILE_SIZE;
+		setFrameRows(h0, h1, aaGrid_m > 1 ? 1 : 0);
+		traceFrame(rend);
+		if (cancel_m) {
+			ok = false;
+			break;
+		}
+
+		// The halo rows are only there to compare against
+		int rows = h1 - h0;
+		int top = frameH1_m - h1;
+		for (int r = 0; r < rows && ok; r++) {
+			int row = top + (bottomUp ? rows - 1 - r : r);
+			ok = sink.writeRow(&framebuffer_m[3 * static_cast<size_t>(row) * width_m]);
+		}
+	}
+	bool ended = sink.end();
+	return ok && ended;
+}
+
+void Renderer::traceFrame(Renderer::RenderMethod rend) {
+	std::vector<Tile> traced, refined;
+	selectTiles(rend, traced, refined);
+	// Incremental renders record hits per tile, so they always go by tiles
+	if (parallel_m || tracking_m) {
+		runTiles(traced, [this, rend](const Tile &tile, int worker) { renderTile(tile, rend); });
+	}
+	else {
+		renderTile(Tile{ 0, frameH0_m, width_m, frameH1_m }, rend);
+	}
+	if (aaGrid_m > 1)
+		refineFrame(rend, traced, refined);
+	finishFrame(traced.size());
+}
+
+bool Renderer::renderProgressive(Renderer::RenderMethod rend, const Renderer::PassFunc &onPass) {
+	std::vector<Tile> tiles, refined;
+	selectTiles(rend, tiles, refined);
+	for (int stride = PROGRESSIVE_STRIDE; stride >= 1; stride /= 2) {
+		runTiles(tiles, [this, rend, stride](const Tile &tile, int worker) {
+			if (!cancel_m)
+				renderTileProgressive(tile, rend, stride);
+		});
+		if (stride == 1 && aaGrid_m > 1)
+			refineFrame(rend, tiles, refined);
+		if (cancel_m) {
+			finishFrame(tiles.size());
+			return false;
+		}
+		onPass(stride);
+	}
+	finishFrame(tiles.size());
+	return true;
+}
+
+// Every tile writes a disjoint block of pixels, so workers
+// can share framebuffer_m without locking.
+void Renderer::runTiles(const std::vector<Tile> &tiles, const TileScheduler::TileFunc &func) {
+	if (parallel_m) {
+		if (!scheduler_m)
+			scheduler_m.reset(new TileScheduler());
+		scheduler_m->run(tiles, func);
+	}
+	else {
+		for (const Tile &tile : tiles)
+			func(tile, 0);
+	}
+}
+
+void Renderer::setResolution(int width, int height) {
+	width_m = std::max(1, width);
+	height_m = std::max(1, height);
+
+	ViewPlane &view = renderCam_m.getView();
+	float halfWidth = view.getHeight() * width_m / height_m / 2;
+	view.setSize(glm::vec2(-halfWidth, view.bottomLeft().y), glm::vec2(halfWidth, view.topRight().y));
+}
+
+void Renderer::beginFrame() {
+	cancel_m = false;
+	// An incremental render starts from the last image
+	bool keep = incremental_m && history_m.valid_m && frameH0_m == 0 && frameH1_m == height_m
+		&& framebuffer_m.size() == static_cast<size_t>(width_m) * height_m * 3;
+	if (!keep) {
+		setFrameRows(0, height_m);
+		sampleCounts_m.assign(static_cast<size_t>(width_m) * height_m, 1);
+	}
+	prepareScene();
+}
+
+void Renderer::setFrameRows(int h0, int h1, int halo) {
+	bandH0_m = h0;
+	bandH1_m = h1;
+	frameH0_m = std::max(0, h0 - halo);
+	frameH1_m = std::min(height_m, h1 + halo);
+	framebuffer_m.assign(static_cast<size_t>(width_m) * (frameH1_m - frameH0_m) * 3, 0.0f);
+}
+
+std::vector<Tile> Renderer::getFrameTiles() const {
+	std::vector<Tile> tiles = TileScheduler::makeTiles(width_m, frameH1_m - frameH0_m, TILE_SIZE);
+	for (Tile &tile : tiles) {
+		tile.y0 += frameH0_m;
+		tile.y1 += frameH0_m;
+	}
+	return tiles;
+}
+
+// Streamed bands are never kept. A marched ray is slowed down by every
+// surface it passes near, so an edit can change pixels whose rays never
+// reach the edited object, and marched frames are always traced whole.
+void Renderer::selectTiles(Renderer::RenderMethod rend, std::vector<Tile> &traced, std::vector<Tile> &refined) {
+	std::vector<Tile> tiles = getFrameTiles();
+	traced = tiles;
+	refined = tiles;
+	tracking_m = incremental_m && rend == Renderer::RenderMethod::RAY_TRACE && frameH0_m == 0 && frameH1_m == height_m;
+	if (!tracking_m) {
+		history_m.valid_m = false;
+		return;
+	}
+
+	snapshotScene(pending_m, rend);
+	std::vector<char> dirty;
+	if (!findDirtyTiles(tiles, dirty)) {
+		tileDeps_m.assign(tiles.size(), TileDeps());
+		sampleCounts_m.assign(static_cast<size_t>(width_m) * height_m, 1);
+		return;
+	}
+
+	// Anti-aliasing compares each pixel with its neighbours, so the
+	// ring of tiles around the re-traced ones is refined again too
+	int tilesX = (width_m + TILE_SIZE - 1) / TILE_SIZE;
+	int tilesY = (height_m + TILE_SIZE - 1) / TILE_SIZE;
+	traced.clear();
+	refined.clear();
+	for (int i = 0; i < tiles.size(); i++) {
+		int tx = i % tilesX;
+		int ty = i / tilesX;
+		bool near = false;
+		for (int y = std::max(0, ty - 1); y <= std::min(tilesY - 1, ty + 1); y++) {
+			for (int x = std::max(0, tx - 1); x <= std::min(tilesX - 1, tx + 1); x++)
+				near = near || dirty[y * tilesX + x];
+		}
+		if (dirty[i])
+			traced.push_back(tiles[i]);
+		if (aaGrid_m > 1 ? near : dirty[i])
+			refined.push_back(tiles[i]);
+	}
+	for (const Tile &tile : refined) {
+		for (int h = tile.y0; h < tile.y1 && !sampleCounts_m.empty(); h++)
+			std::fill_n(&sampleCounts_m[static_cast<size_t>(height_m - h - 1) * width_m + tile.x0], tile.x1 - tile.x0, 1);
+	}
+}
+
+// Objects are compared by what their compiled primitives hold, so any
+// edit that changes how rays hit them is seen, whatever its source
+void Renderer::snapshotScene(FrameHistory &state, Renderer::RenderMethod rend) {
+	ViewPlane &view = renderCam_m.getView();
+	glm::vec3 corners[] = { renderCam_m.getWorldPosition(), view.toWorld(0, 0), view.toWorld(1, 1) };
+	int settings[] = { width_m, height_m, rend, aaGrid_m, packets_m };
+	float ambient = ambientLight_m->getIntensity();
+	uint64_t viewHash = 14695981039346656037ull;
+	viewHash = SDFCache::hash(viewHash, corners, sizeof(corners));
+	viewHash = SDFCache::hash(viewHash, settings, sizeof(settings));
+	viewHash = SDFCache::hash(viewHash, &aaThreshold_m, sizeof(aaThreshold_m));
+	viewHash = SDFCache::hash(viewHash, &ambient, sizeof(ambient));
+	for (Light *light : lights_m) {
+		glm::vec3 pos = light->getWorldPosition();
+		float intensity = light->getIntensity();
+		viewHash = SDFCache::hash(viewHash, &pos, sizeof(pos));
+		viewHash = SDFCache::hash(viewHash, &intensity, sizeof(intensity));
+	}
+	state.viewHash_m = viewHash;
+
+	state.objects_m = scene_m;
+	state.objectHashes_m.assign(scene_m.size(), 14695981039346656037ull);
+	state.objectBounds_m.assign(scene_m.size(), AABB());
+	std::vector<char> unbounded(scene_m.size(), 0);
+	const RenderScene &scene = sceneBVH_m.getRenderScene();
+	for (int prim = 0; prim < scene.size(); prim++) {
+		int obj = scene.getPrim(prim).object_m;
+		state.objectHashes_m[obj] = scene.hashPrim(prim, state.objectHashes_m[obj]);
+		AABB bounds = scene.getWorldBounds(prim);
+		if (bounds.valid())
+			state.objectBounds_m[obj].grow(bounds);
+		else
+			unbounded[obj] = 1;
+	}
+	for (int i = 0; i < scene_m.size(); i++) {
+		ofColor colors[] = { scene_m[i]->getDiffuse(), scene_m[i]->getSpecular() };
+		state.objectHashes_m[i] = SDFCache::hash(state.objectHashes_m[i], colors, sizeof(colors));
+		if (unbounded[i])
+			state.objectBounds_m[i] = AABB();
+	}
+}
+
+// A tile is traced again if a changed object was seen in it, may now
+// be seen in it, or may cast a shadow on it. Shadow rays leave the hit
+// points for the lights, so they stay in the box around the tile's hits
+// and a light; an object outside every such box, before and after it
+// changed, cannot shadow the tile. Returns false if the whole frame has
+// to be traced.
+bool Renderer::findDirtyTiles(const std::vector<Tile> &tiles, std::vector<char> &dirty) {
+	const FrameHistory &last = history_m;
+	const FrameHistory &now = pending_m;
+	if (!last.valid_m || last.viewHash_m != now.viewHash_m || last.objects_m != now.objects_m || tileDeps_m.size() != tiles.size())
+		return false;
+
+	int tilesX = (width_m + TILE_SIZE - 1) / TILE_SIZE;
+	dirty.assign(tiles.size(), 0);
+	for (int obj = 0; obj < now.objects_m.size(); obj++) {
+		if (last.objectHashes_m[obj] == now.objectHashes_m[obj])
+			continue;
+		const AABB &before = last.objectBounds_m[obj];
+		const AABB &after = now.objectBounds_m[obj];
+		if (!before.valid() || !after.valid())
+			return false;
+
+		int w0, h0, w1, h1;
+		if (!projectBounds(after, w0, h0, w1, h1))
+			return false;
+		w0 = std::max(w0, 0);
+		h0 = std::max(h0, 0);
+		w1 = std::min(w1, width_m - 1);
+		h1 = std::min(h1, height_m - 1);
+		for (int ty = h0 / TILE_SIZE; h0 <= h1 && ty <= h1 / TILE_SIZE; ty++) {
+			for (int tx = w0 / TILE_SIZE; w0 <= w1 && tx <= w1 / TILE_SIZE; tx++)
+				dirty[ty * tilesX + tx] = 1;
+		}
+
+		for (int i = 0; i < tiles.size(); i++) {
+			const TileDeps &deps = tileDeps_m[i];
+			if (dirty[i] || !deps.hitBounds_m.valid())
+				continue;
+			if (std::find(deps.objects_m.begin(), deps.objects_m.end(), obj) != deps.objects_m.end()) {
+				dirty[i] = 1;
+				continue;
+			}
+			AABB hits = deps.hitBounds_m;
+			hits.min_m -= glm::vec3(SHADOW_BIAS);
+			hits.max_m += glm::vec3(SHADOW_BIAS);
+			for (Light *light : lights_m) {
+				AABB reach = hits;
+				reach.grow(light->getWorldPosition());
+				if (reach.overlaps(before) || reach.overlaps(after)) {
+					dirty[i] = 1;
+					break;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+bool Renderer::projectBounds(const AABB &box, int &w0, int &h0, int &w1, int &h1) {
+	ViewPlane &view = renderCam_m.getView();
+	glm::vec3 eye = renderCam_m.getWorldPosition();
+	glm::vec3 p00 = view.toWorld(0, 0);
+	glm::vec3 p11 = view.toWorld(1, 1);
+	float planeDepth = p00.z - eye.z;
+	glm::vec2 lo(FLT_MAX), hi(-FLT_MAX);
+	for (int i = 0; i < 8; i++) {
+		glm::vec3 corner((i & 1) ? box.max_m.x : box.min_m.x, (i & 2) ? box.max_m.y : box.min_m.y, (i & 4) ? box.max_m.z : box.min_m.z);
+		float depth = corner.z - eye.z;
+		if (depth * planeDepth <= 0)
+			return false;
+		glm::vec3 onPlane = eye + (corner - eye) * (planeDepth / depth);
+		glm::vec2 uv((onPlane.x - p00.x) / (p11.x - p00.x), (onPlane.y - p00.y) / (p11.y - p00.y));
+		lo = glm::min(lo, uv);
+		hi = glm::max(hi, uv);
+	}
+	// Far off screen is as good as just off it
+	lo = glm::clamp(lo, glm::vec2(-1), glm::vec2(2));
+	hi = glm::clamp(hi, glm::vec2(-1), glm::vec2(2));
+	// Pixel w is centered on u = (w + 0.5) / width
+	w0 = static_cast<int>(std::floor(lo.x * width_m - 0.5f)) - 1;
+	h0 = static_cast<int>(std::floor(lo.y * height_m - 0.5f)) - 1;
+	w1 = static_cast<int>(std::ceil(hi.x * width_m - 0.5f)) + 1;
+	h1 = static_cast<int>(std::ceil(hi.y * height_m - 0.5f)) + 1;
+	return true;
+}
+
+void Renderer::recordTile(const Tile &tile, bool clear) {
+	recording_t = nullptr;
+	if (!tracking_m)
+		return;
+	TileDeps &deps = tileDeps_m[tileIndex(tile)];
+	if (clear)
+		deps = TileDeps();
+	recording_t = &deps;
+}
+
+void Renderer::TileDeps::add(int object, const glm::vec3 &point) {
+	if (std::find(objects_m.begin(), objects_m.end(), object) == objects_m.end())
+		objects_m.push_back(object);
+	hitBounds_m.grow(point);
+}
+
+// A cancelled frame is partly old and partly new, and is not built on
+void Renderer::finishFrame(int traced) {
+	RENDER_STATS_ADD(TILES_TRACED, traced);
+	RENDER_STATS_ADD(TILES_TOTAL, (width_m + TILE_SIZE - 1) / TILE_SIZE * ((frameH1_m - frameH0_m + TILE_SIZE - 1) / TILE_SIZE));
+	if (!tracking_m)
+		return;
+	tracking_m = false;
+	if (cancel_m) {
+		history_m.valid_m = false;
+		return;
+	}
+	history_m = std::move(pending_m);
+	history_m.valid_m = true;
+}
+
+void Renderer::prepareScene() {
+	// Resolve every cached transform before any ray reads it
+	renderCam_m.updateMatrices();
+	ambientLight_m->updateMatrices();
+	for (SceneObject *obj : scene_m)
+		obj->updateMatrices();
+	for (Light *light : lights_m)
+		light->updateMatrices();
+	sceneBVH_m.update(scene_m);
+	updateSDFPrims();
+	updateSDFCache();
+}
+
+// Unbounded objects (the ground Plane) go first. They cannot be
+// culled, so they give sceneSDF a distance to cull the rest against.
+void Renderer::updateSDFPrims() {
+	sdfPrims_m.clear();
+	sdfSlot_m.assign(scene_m.size(), -1);
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < scene_m.size(); i++) {
+			if (!scene_m[i]->hasSDF())
+				continue;
+			SDFPrim prim;
+			prim.index_m = i;
+			prim.static_m = scene_m[i]->isStatic();
+			prim.bounded_m = scene_m[i]->getSDFBounds(prim.center_m, prim.radius_m);
+			if (prim.bounded_m == (pass == 1)) {
+				sdfSlot_m[i] = static_cast<int>(sdfPrims_m.size());
+				sdfPrims_m.push_back(prim);
 			}
+		}
+	}
+}
 
-			if (!hit)
-				image_m.setColor(w, imageHeight - h - 1, ofColor::black);
-			else {
-				ofColor color = phong(nearestPoint, nearestNorm, scene_m[nearestObj_m]->getDiffuse(), scene_m[nearestObj_m]->getSpecular(), 10.0, rend);
-				image_m.setColor(w, imageHeight - h - 1, color);
-				//image_m.setColor(w, imageHeight - h - 1, ofColor::white);
+void Renderer::renderTile(const Tile &tile, Renderer::RenderMethod rend) {
+	recordTile(tile, true);
+	if (packets_m && rend == Renderer::RenderMethod::RAY_TRACE) {
+		renderTilePackets(tile);
+	}
+	else {
+		for (int w = tile.x0; w < tile.x1; w++) {
+			for (int h = tile.y0; h < tile.y1; h++) {
+				setPixel(w, h, renderPixel(w, h, rend));
 			}
 		}
 	}
-	std::cout << "Image Saved.\n";
-	image_m.save(filename);
-	
+	recording_t = nullptr;
 }
 
-bool Renderer::inShadow(Ray pointToLight, glm::vec3 lightPos) {
-	glm::vec3 intersectPoint, normal;
-	//float bias = 0.001;
-	for (int i = 0; i < scene_m.size(); i++) {
-		if (nearestObj_m != i
-			&& scene_m[i]->intersect(pointToLight, intersectPoint, normal) 
-			&& !(glm::length(intersectPoint - pointToLight.getPosition()) > glm::length(lightPos - pointToLight.getPosition())))
-		{
-			return true;
+// Pixels on the stride grid, skipping those on the coarser grid of
+// the previous pass, are traced and fill the stride x stride block
+// above and to the right of them until a finer pass overwrites it.
+void Renderer::renderTileProgressive(const Tile &tile, Renderer::RenderMethod rend, int stride) {
+	int coarser = stride * 2;
+	recordTile(tile, stride == PROGRESSIVE_STRIDE);
+	for (int w = tile.x0 + (stride - tile.x0 % stride) % stride; w < tile.x1; w += stride) {
+		for (int h = tile.y0 + (stride - tile.y0 % stride) % stride; h < tile.y1; h += stride) {
+			if (stride < PROGRESSIVE_STRIDE && w % coarser == 0 && h % coarser == 0)
+				continue;
+			ofColor color = renderPixel(w, h, rend);
+			for (int x = w; x < std::min(w + stride, tile.x1); x++) {
+				for (int y = h; y < std::min(h + stride, tile.y1); y++)
+					setPixel(x, y, color);
+			}
 		}
 	}
-	return false;
+	recording_t = nullptr;
 }
 
-ofColor Renderer::phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse, const ofColor specular, float power, Renderer::RenderMethod rend) {
+// Rows of the tile are cut into packets of neighbouring pixels. The
+// packet finds the nearest primitive and distance per pixel; spheres
+// and planes get their point and normal straight from that distance,
+// only primitives the packet tested lane by lane are intersected again.
+// Shading then matches the single ray path up to rounding.
+void Renderer::renderTilePackets(const Tile &tile) {
+	for (int h = tile.y0; h < tile.y1; h++) {
+		for (int w = tile.x0; w < tile.x1; w += PACKET_SIZE) {
+			int lanes = std::min(PACKET_SIZE, tile.x1 - w);
+			RayPacket packet;
+			for (int lane = 0; lane < PACKET_SIZE; lane++)
+				packet.setRay(lane, getPixelRay(w + std::min(lane, lanes - 1), h));
+			packet.activeMask_m = (1 << lanes) - 1;
+
+			RENDER_STATS_ADD(PRIMARY_RAYS, lanes);
+			PacketHit hit;
+			sceneBVH_m.intersectPacket(packet, hit);
+
+			for (int lane = 0; lane < lanes; lane++) {
+				ofColor color = ofColor::black;
+				int nearestObj = hit.obj_m[lane];
+				if (nearestObj >= 0) {
+					Ray ray = packet.getRay(lane);
+					glm::vec3 nearestPoint;
+					glm::vec3 nearestNorm;
+					if (sceneBVH_m.getRenderScene().hitAt(hit.prim_m[lane], ray, hit.t_m[lane], nearestPoint, nearestNorm)
+						|| rayTraceHit(ray, nearestPoint, nearestNorm, nearestObj))
+					{
+						color = phong(nearestPoint, nearestNorm, scene_m[nearestObj]->getDiffuse(), scene_m[nearestObj]->getSpecular(), 10.0, Renderer::RenderMethod::RAY_TRACE, nearestObj);
+						if (recording_t)
+							recording_t->add(nearestObj, nearestPoint);
+					}
+				}
+				setPixel(w + lane, h, color);
+			}
+		}
+	}
+}
+
+void Renderer::getPixels(ofPixels &pixels) const {
+	pixels.allocate(width_m, frameH1_m - frameH0_m, 3);
+	unsigned char *data = pixels.getData();
+	for (size_t i = 0; i < framebuffer_m.size(); i++)
+		data[i] = static_cast<unsigned char>(glm::clamp(framebuffer_m[i], 0.0f, 1.0f) * 255 + 0.5f);
+}
+
+Renderer::MemoryUsage Renderer::getMemoryUsage() const {
+	MemoryUsage usage;
+	usage.framebuffer = (framebuffer_m.capacity() + unrefined_m.capacity()) * sizeof(float) + sampleCounts_m.capacity() * sizeof(unsigned short);
+	usage.sceneBVH = sceneBVH_m.getMemoryUsage();
+	usage.sdfCache = sdfCacheActive_m ? sdfCache_m.getMemoryUsage() : 0;
+	std::set<const TriangleBuffer *> counted;
+	for (SceneObject *obj : scene_m) {
+		Mesh *mesh = dynamic_cast<Mesh *>(obj);
+		if (mesh && counted.insert(&mesh->getTriangles()).second)
+			usage.meshes += mesh->getGeometryMemoryUsage();
+	}
+	return usage;
+}
+
+Ray Renderer::getPixelRay(int w, int h) {
+	float u = (w + 0.5) / width_m;
+	float v = (h + 0.5) / height_m;
+	return renderCam_m.getRay(u, v);
+}
+
+Ray Renderer::getSampleRay(float x, float y) {
+	return renderCam_m.getRay(x / width_m, y / height_m);
+}
+
+ofColor Renderer::renderPixel(int w, int h, Renderer::RenderMethod rend) {
+	return traceRay(getPixelRay(w, h), rend);
+}
+
+ofColor Renderer::traceRay(const Ray &ray, Renderer::RenderMethod rend) {
+	RENDER_STATS_ADD(PRIMARY_RAYS, 1);
+
+	glm::vec3 nearestPoint;
+	glm::vec3 nearestNorm;
+	int nearestObj = -1;
+	bool hit;
+
+	switch (rend)
+	{
+	// Ray Trace Algorithm
+	case Renderer::RenderMethod::RAY_TRACE:
+		hit = rayTraceHit(ray, nearestPoint, nearestNorm, nearestObj);
+		break;
+
+	// Ray March Algorithm
+	case Renderer::RenderMethod::RAY_MARCH:
+		hit = rayMarchHit(ray, nearestPoint, nearestNorm, nearestObj);
+		break;
+	}
+
+	if (!hit)
+		return ofColor::black;
+	if (recording_t)
+		recording_t->add(nearestObj, nearestPoint);
+	return phong(nearestPoint, nearestNorm, scene_m[nearestObj]->getDiffuse(), scene_m[nearestObj]->getSpecular(), 10.0, rend, nearestObj);
+}
+
+void Renderer::setAntialiasing(int maxSamples, float threshold) {
+	aaGrid_m = std::max(1, static_cast<int>(std::round(std::sqrt(static_cast<float>(std::max(1, maxSamples))))));
+	aaThreshold_m = threshold;
+}
+
+// Neighbours are compared in a copy of the one ray per pixel image,
+// so tiles refined concurrently all see the same input and the
+// result does not depend on the order tiles run in. An incremental
+// render keeps that copy and updates the traced tiles in it, so tiles
+// refined again next to old ones compare against the same pixels a
+// full render would.
+void Renderer::refineFrame(Renderer::RenderMethod rend, const std::vector<Tile> &traced, const std::vector<Tile> &refined) {
+	auto copyTile = [this](const Tile &tile, const std::vector<float> &from, std::vector<float> &to) {
+		for (int h = tile.y0; h < tile.y1; h++) {
+			size_t begin = 3 * pixelIndex(tile.x0, h);
+			std::copy(from.begin() + begin, from.begin() + begin + 3 * (tile.x1 - tile.x0), to.begin() + begin);
+		}
+	};
+	if (tracking_m && unrefined_m.size() == framebuffer_m.size()) {
+		for (const Tile &tile : traced)
+			copyTile(tile, framebuffer_m, unrefined_m);
+		for (const Tile &tile : refined)
+			copyTile(tile, unrefined_m, framebuffer_m);
+	}
+	else {
+		unrefined_m = framebuffer_m;
+	}
+
+	runTiles(refined, [this, rend](const Tile &tile, int worker) {
+		if (!cancel_m) {
+			recordTile(tile, false);
+			refineTile(tile, unrefined_m, rend);
+			recording_t = nullptr;
+		}
+	});
+	if (!tracking_m)
+		std::vector<float>().swap(unrefined_m);
+}
+
+void Renderer::refineTile(const Tile &tile, const std::vector<float> &base, Renderer::RenderMethod rend) {
+	// Halo rows are compared against but left as traced; the band
+	// next to them refines them itself
+	auto at = [&](int w, int h) { return &base[3 * pixelIndex(w, h)]; };
+	auto differs = [this](const float *a, const float *b) {
+		return std::fabs(a[0] - b[0]) > aaThreshold_m || std::fabs(a[1] - b[1]) > aaThreshold_m || std::fabs(a[2] - b[2]) > aaThreshold_m;
+	};
+
+	for (int w = tile.x0; w < tile.x1; w++) {
+		for (int h = std::max(tile.y0, bandH0_m); h < std::min(tile.y1, bandH1_m); h++) {
+			const float *c = at(w, h);
+			bool edge = (w > 0 && differs(c, at(w - 1, h))) || (w + 1 < width_m && differs(c, at(w + 1, h)))
+				|| (h > frameH0_m && differs(c, at(w, h - 1))) || (h + 1 < frameH1_m && differs(c, at(w, h + 1)));
+			if (!edge)
+				continue;
+
+			float spread;
+			int count = 1 + 4;
+			glm::vec3 color = supersample(w, h, 2, rend, spread);
+			if (aaGrid_m > 2 && spread > aaThreshold_m) {
+				color = supersample(w, h, aaGrid_m, rend, spread);
+				count += aaGrid_m * aaGrid_m;
+			}
+			float *p = &framebuffer_m[3 * pixelIndex(w, h)];
+			p[0] = color.x;
+			p[1] = color.y;
+			p[2] = color.z;
+			if (!sampleCounts_m.empty())
+				sampleCounts_m[static_cast<size_t>(height_m - h - 1) * width_m + w] = count;
+		}
+	}
+}
+
+// Mean of grid x grid samples, one jittered sample per cell of the
+// pixel. spread is the largest channel range among the samples.
+glm::vec3 Renderer::supersample(int w, int h, int grid, Renderer::RenderMethod rend, float &spread) {
+	uint32_t seed = (static_cast<uint32_t>(h) * width_m + w) * 0x9E3779B9u + grid;
+	glm::vec3 sum(0), lo(FLT_MAX), hi(-FLT_MAX);
+	for (int j = 0; j < grid; j++) {
+		for (int i = 0; i < grid; i++) {
+			uint32_t k = 2 * (j * grid + i);
+			float x = w + (i + hashToUnit(seed + k)) / grid;
+			float y = h + (j + hashToUnit(seed + k + 1)) / grid;
+			ofColor c = traceRay(getSampleRay(x, y), rend);
+			glm::vec3 rgb = glm::vec3(c.r, c.g, c.b) / 255.0f;
+			sum += rgb;
+			lo = glm::min(lo, rgb);
+			hi = glm::max(hi, rgb);
+		}
+	}
+	glm::vec3 range = hi - lo;
+	spread = std::max(range.x, std::max(range.y, range.z));
+	return sum / static_cast<float>(grid * grid);
+}
+
+void Renderer::getSampleCountPixels(ofPixels &pixels) const {
+	int most = 1 + 4 + (aaGrid_m > 2 ? aaGrid_m * aaGrid_m : 0);
+	pixels.allocate(width_m, height_m, 3);
+	unsigned char *data = pixels.getData();
+	size_t pixelCount = static_cast<size_t>(width_m) * height_m;
+	for (size_t i = 0; i < pixelCount; i++) {
+		int count = i < sampleCounts_m.size() ? sampleCounts_m[i] : 1;
+		unsigned char gray = static_cast<unsigned char>(255.0f * (count - 1) / (most - 1) + 0.5f);
+		data[3 * i] = data[3 * i + 1] = data[3 * i + 2] = gray;
+	}
+}
+
+bool Renderer::inShadow(Ray pointToLight, glm::vec3 lightPos, int nearestObj) {
+	//float bias = 0.001;
+	return sceneBVH_m.occluded(pointToLight, glm::length(lightPos - pointToLight.getPosition()), nearestObj);
+}
+
+ofColor Renderer::phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse, const ofColor specular, float power, Renderer::RenderMethod rend, int nearestObj) {
 	ofColor color = /*ambientLight_m->getDiffuse()*/diffuse * ambientLight_m->getIntensity();
 	ofColor lambert, phong;
-	float shadowBias = 0.1;
+	RENDER_STATS_ADD(SHADOW_RAYS, lights_m.size());
 	for (int i = 0; i < lights_m.size(); i++) {
 		glm::vec3 n = glm::normalize(norm);
 		glm::vec3 l = glm::normalize(lights_m[i]->getWorldPosition() - p);
@@ -71,16 +708,17 @@ ofColor Renderer::phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor
 
 		glm::vec3 nearestPoint;
 		glm::vec3 nearestNormal;
+		int shadowObj = -1;
 		bool shadow;
 
 		switch (rend)
 		{
 		case Renderer::RenderMethod::RAY_TRACE:
-			shadow = inShadow(Ray(p + (n * shadowBias), l), lights_m[i]->getWorldPosition());
+			shadow = inShadow(Ray(p + (n * SHADOW_BIAS), l), lights_m[i]->getWorldPosition(), nearestObj);
 			break;
 
 		case Renderer::RenderMethod::RAY_MARCH:
-			shadow = ((rayMarchHit(Ray(p + (n * shadowBias), l), nearestPoint, nearestNormal)) /*|| glm::length(nearestPoint - p) > glm::length(lights_m[i]->getPosition() - p)*/);
+			shadow = ((rayMarchHit(Ray(p + (n * SHADOW_BIAS), l), nearestPoint, nearestNormal, shadowObj)) /*|| glm::length(nearestPoint - p) > glm::length(lights_m[i]->getPosition() - p)*/);
 			break;
 		}
 		if (!shadow) {
@@ -93,52 +731,142 @@ ofColor Renderer::phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor
 	return color;
 }
 
-float Renderer::sceneSDF(const glm::vec3 &p) {
+// The key covers the static objects' type, transform and distance at
+// a few probe points (which catches size changes), plus the grid
+// settings. Any change bakes a new grid instead of reusing a stale one.
+void Renderer::updateSDFCache() {
+	sdfCacheActive_m = false;
+	if (!bakeStatic_m)
+		return;
+
+	uint64_t key = 14695981039346656037ull;
+	const glm::vec3 probes[] = { glm::vec3(0, 0, 0), glm::vec3(1, 2, 3), glm::vec3(-5, 1, 4), glm::vec3(7, -3, -6) };
+	int staticCount = 0;
+	for (const SDFPrim &prim : sdfPrims_m) {
+		if (!prim.static_m)
+			continue;
+		SceneObject *obj = scene_m[prim.index_m];
+		const char *type = typeid(*obj).name();
+		key = SDFCache::hash(key, &prim.index_m, sizeof(prim.index_m));
+		key = SDFCache::hash(key, type, std::strlen(type));
+		key = SDFCache::hash(key, &obj->getMatrix(), sizeof(glm::mat4));
+		for (const glm::vec3 &probe : probes) {
+			float d = obj->sdf(probe);
+			key = SDFCache::hash(key, &d, sizeof(d));
+		}
+		staticCount++;
+	}
+	if (staticCount == 0)
+		return;
+	key = SDFCache::hash(key, &bakeBounds_m, sizeof(bakeBounds_m));
+	key = SDFCache::hash(key, &SDF_CACHE_VOXEL, sizeof(SDF_CACHE_VOXEL));
+
+	if (sdfCache_m.empty() || sdfCache_m.getKey() != key) {
+		std::stringstream name;
+		name << "sdfcache/" << std::hex << key << ".sdfc";
+		std::string path = ofToDataPath(name.str());
+		if (sdfCache_m.load(path, key)) {
+			std::cout << "SDF cache loaded from " << path << "\n";
+		}
+		else {
+			sdfCache_m.build(key, bakeBounds_m, SDF_CACHE_VOXEL, [this](const glm::vec3 &p, int &object) { return staticSDF(p, object); });
+			std::cout << "SDF cache baked: " << sdfCache_m.getDenseBrickCount() << " dense bricks, "
+				<< sdfCache_m.getMemoryUsage() / (1024.0f * 1024.0f) << " MB in " << sdfCache_m.getBuildTime() << " ms\n";
+			ofDirectory::createDirectory("sdfcache", true, true);
+			if (!sdfCache_m.save(path))
+				std::cerr << path << " could not be saved!\n";
+		}
+	}
+	sdfCacheActive_m = true;
+}
+
+float Renderer::staticSDF(const glm::vec3 &p, int &nearestObj) {
 	float closestDistance = FLT_MAX;
-	for (int i = 0; i < scene_m.size(); i++) {
-		if (scene_m[i]->hasSDF()) {
-			float d = scene_m[i]->sdf(p);
-			if (d < closestDistance) {
-				closestDistance = d;
-				nearestObj_m = i;
-			}
+	for (const SDFPrim &prim : sdfPrims_m) {
+		if (!prim.static_m)
+			continue;
+		float d = scene_m[prim.index_m]->sdf(p);
+		if (d < closestDistance) {
+			closestDistance = d;
+			nearestObj = prim.index_m;
 		}
 	}
 	return closestDistance;
 }
 
-bool Renderer::rayTraceHit(Ray r, glm::vec3 &nearestPoint, glm::vec3 &nearestNormal)
-{
-	glm::vec3 intersectPoint;
-	glm::vec3 normal;
-	bool hit = false;
-	float nearestDistance = std::numeric_limits<float>::max();
+// The object nearest at the previous step is evaluated first, and
+// objects whose SDF bounding sphere is farther than the best distance
+// so far are skipped with a squared distance test. Ties still go to the lowest scene index, so the
+// result is the same as evaluating every object in order.
+float Renderer::sceneSDF(const glm::vec3 &p, int &nearestObj) {
+	float closestDistance = FLT_MAX;
+	int closestObj = -1;
+	int evals = 0;
 
-	//ofColor setColor = ofColor::black;
-	for (int i = 0; i < scene_m.size(); i++)
-	{
-		if (scene_m[i]->intersect(r, intersectPoint, normal))
-		{
-			float dist = glm::length(intersectPoint - renderCam_m.getWorldPosition());
-			if (nearestDistance > dist) {
-				nearestDistance = dist;
-				nearestObj_m = i;
-				nearestPoint = intersectPoint;
-				nearestNormal = normal;
+	// Away from static surfaces the baked grid stands in for every
+	// static object. Close to them they are evaluated exactly, so hits
+	// and the object that was hit are the same as without the grid.
+	bool skipStatic = false;
+	if (sdfCacheActive_m) {
+		float cached;
+		int cachedObj;
+		if (sdfCache_m.sample(p, cached, cachedObj) && cached >= DIST_THRESHOLD + sdfCache_m.getVoxelSize()) {
+			closestDistance = cached;
+			closestObj = cachedObj;
+			skipStatic = true;
+		}
+	}
 
-			}
-			hit = true;
+	auto evaluate = [&](const SDFPrim &prim) {
+		if (skipStatic && prim.static_m)
+			return;
+		// length(p - center) - radius > closest, without the square
+		// root, which for a sphere would cost as much as its sdf
+		if (prim.bounded_m) {
+			glm::vec3 offset = p - prim.center_m;
+			float reach = closestDistance + prim.radius_m;
+			if (reach < 0 || glm::dot(offset, offset) > reach * reach)
+				return;
 		}
+		evals++;
+		float d = scene_m[prim.index_m]->sdf(p);
+		if (d < closestDistance || (d == closestDistance && prim.index_m < closestObj)) {
+			closestDistance = d;
+			closestObj = prim.index_m;
+		}
+	};
+
+	int first = nearestObj >= 0 && nearestObj < sdfSlot_m.size() ? sdfSlot_m[nearestObj] : -1;
+	if (first >= 0)
+		evaluate(sdfPrims_m[first]);
+	for (int i = 0; i < sdfPrims_m.size(); i++) {
+		if (i != first)
+			evaluate(sdfPrims_m[i]);
 	}
-	return hit;
+	RENDER_STATS_ADD(SDF_EVALS, evals);
+	if (closestObj >= 0)
+		nearestObj = closestObj;
+	return closestDistance;
+}
+
+bool Renderer::rayTraceHit(Ray r, glm::vec3 &nearestPoint, glm::vec3 &nearestNormal, int &nearestObj)
+{
+	// Primary rays start at the camera, so distance from the ray
+	// origin is distance from the camera.
+	return sceneBVH_m.intersect(r, nearestPoint, nearestNormal, nearestObj);
 }
 
 
-bool Renderer::rayMarchHit(Ray r, glm::vec3 &nearestPoint, glm::vec3 &nearestNormal) {
+bool Renderer::rayMarchHit(Ray r, glm::vec3 &nearestPoint, glm::vec3 &nearestNormal, int &nearestObj) {
+	if (relaxedMarch_m)
+		return relaxedMarchHit(r, nearestPoint, nearestNormal, nearestObj);
+
 	bool hit = false;
 	nearestPoint = r.getPosition();
-	for (int i = 0; i < MAX_RAY_STEPS; i++) {
-		float dist = sceneSDF(nearestPoint);
+	int steps = 0;
+	for (int i = 0; i < marchSteps_m; i++) {
+		steps++;
+		float dist = sceneSDF(nearestPoint, nearestObj);
 		if (dist < DIST_THRESHOLD) {
 			hit = true;
 
@@ -148,12 +876,92 @@ bool Renderer::rayMarchHit(Ray r, glm::vec3 &nearestPoint, glm::vec3 &nearestNor
 			break;
 		else nearestPoint += r.getDirection() * dist;
 	}
-	nearestNormal = getNormalRM(nearestPoint);
+	RENDER_STATS_ADD(MARCH_STEPS, steps);
+	if (hit)
+		nearestNormal = getNormalRM(nearestPoint, nearestObj);
+	return hit;
+}
+
+// Over-relaxed sphere tracing (Keinert et al. 2014). Each step goes
+// MARCH_RELAXATION times the distance bound. If the unbounding spheres
+// of two consecutive points no longer overlap, the step may have
+// jumped over a surface, and if the distance turns negative it landed
+// inside one. Either way the step is undone and marching goes on with
+// plain steps from the last point known to be safe, so a hit is only
+// taken within DIST_THRESHOLD of a surface.
+bool Renderer::relaxedMarchHit(Ray r, glm::vec3 &nearestPoint, glm::vec3 &nearestNormal, int &nearestObj) {
+	const glm::vec3 &orig = r.getPosition();
+	const glm::vec3 &dir = r.getDirection();
+	float omega = MARCH_RELAXATION;
+	float t = 0;
+	float prevT = 0;
+	float prevDist = 0;
+	bool hit = false;
+	int steps = 0;
+	for (int i = 0; i < marchSteps_m; i++) {
+		steps++;
+		float dist = sceneSDF(orig + dir * t, nearestObj);
+		if (omega > 1 && (dist < 0 || std::fabs(dist) + prevDist < t - prevT)) {
+			t = prevT + prevDist;
+			omega = 1;
+			continue;
+		}
+		// Negative only for a ray starting inside an object, which
+		// plain marching also counts as a hit
+		if (std::fabs(dist) < DIST_THRESHOLD || dist < 0) {
+			hit = true;
+			break;
+		}
+		else if (dist > MAX_DISTANCE)
+			break;
+		prevT = t;
+		prevDist = dist;
+		t += dist * omega;
+	}
+	RENDER_STATS_ADD(MARCH_STEPS, steps);
+	nearestPoint = orig + dir * t;
+	if (hit)
+		nearestNormal = getNormalRM(nearestPoint, nearestObj);
 	return hit;
 }
 
-glm::vec3 Renderer::getNormalRM(const glm::vec3 &nearestPoint) {
-	float eps = 0.01;
-	glm::vec3 n(sceneSDF(glm::vec3(nearestPoint.x + eps, nearestPoint.y, nearestPoint.z)) - sceneSDF(glm::vec3(nearestPoint.x - eps, nearestPoint.y, nearestPoint.z)), sceneSDF(glm::vec3(nearestPoint.x, nearestPoint.y + eps, nearestPoint.z)) - sceneSDF(glm::vec3(nearestPoint.x, nearestPoint.y - eps, nearestPoint.z)), sceneSDF(glm::vec3(nearestPoint.x, nearestPoint.y, nearestPoint.z + eps)) - sceneSDF(glm::vec3(nearestPoint.x, nearestPoint.y, nearestPoint.z - eps)));
+// Objects with an exact gradient give the normal directly. Otherwise
+// it is estimated from the 4 taps of a tetrahedron around the point
+// (Quilez), evaluating every object once for all taps. nearestObj is
+// only a hint here and is left as the object that was hit.
+glm::vec3 Renderer::getNormalRM(const glm::vec3 &nearestPoint, int nearestObj) {
+	glm::vec3 gradient;
+	if (nearestObj >= 0 && nearestObj < scene_m.size() && scene_m[nearestObj]->sdfGradient(nearestPoint, gradient))
+		return gradient;
+
+	static const glm::vec3 taps[4] = { glm::vec3(1, -1, -1), glm::vec3(-1, -1, 1), glm::vec3(-1, 1, -1), glm::vec3(1, 1, 1) };
+	float tapDist[4] = { FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX };
+	float tapReach = NORMAL_EPSILON * 1.7320508f;
+	int evals = 0;
+	auto evaluate = [&](const SDFPrim &prim) {
+		// Skip the object if its bound is beyond every tap's distance so far
+		if (prim.bounded_m) {
+			float bound = glm::length(nearestPoint - prim.center_m) - prim.radius_m - tapReach;
+			if (bound > tapDist[0] && bound > tapDist[1] && bound > tapDist[2] && bound > tapDist[3])
+				return;
+		}
+		evals += 4;
+		SceneObject *obj = scene_m[prim.index_m];
+		for (int k = 0; k < 4; k++)
+			tapDist[k] = std::min(tapDist[k], obj->sdf(nearestPoint + taps[k] * NORMAL_EPSILON));
+	};
+
+	int first = nearestObj >= 0 && nearestObj < sdfSlot_m.size() ? sdfSlot_m[nearestObj] : -1;
+	if (first >= 0)
+		evaluate(sdfPrims_m[first]);
+	for (int i = 0; i < sdfPrims_m.size(); i++) {
+		if (i != first)
+			evaluate(sdfPrims_m[i]);
+	}
+	RENDER_STATS_ADD(SDF_EVALS, evals);
+
+	glm::vec3 n(0);
+	for (int k = 0; k < 4; k++)
+		n += taps[k] * tapDist[k];
 	return glm::normalize(n);
 }
\ No newline at end of file
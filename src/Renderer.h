@@ -1,11 +1,20 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "ofMain.h"
+#include "ImageSink.h"
 #include "Ray.h"
+#include "RenderStats.h"
+#include "SceneBVH.h"
 #include "SceneObject.h"
+#include "SDFCache.h"
+#include "TileScheduler.h"
 
 class Renderer
 {
@@ -15,20 +24,119 @@ public:
 		RAY_MARCH,
 	};
 
-	static const int imageWidth{ 600 };
-	static const int imageHeight{ 400 };
+	// Resolution until setResolution() is called
+	static const int DEFAULT_WIDTH{ 600 };
+	static const int DEFAULT_HEIGHT{ 400 };
+	static const int TILE_SIZE{ 32 };
+	// The first progressive pass traces every 8th pixel in x and y
+	static const int PROGRESSIVE_STRIDE{ 8 };
+
+	// Adaptive anti-aliasing defaults, see setAntialiasing()
+	static const int DEFAULT_AA_SAMPLES{ 16 };
+	static const float DEFAULT_AA_THRESHOLD;
+
+	// Called after each progressive pass, stride 1 being the last
+	typedef std::function<void(int stride)> PassFunc;
+
+	// Bytes held by each part of a render
+	struct MemoryUsage
+	{
+		size_t framebuffer = 0;
+		size_t sceneBVH = 0;
+		size_t meshes = 0;	// shared mesh geometry is counted once
+		size_t sdfCache = 0;
+		size_t total() const { return framebuffer + sceneBVH + meshes + sdfCache; }
+	};
 
 private:
 	static const int MAX_RAY_STEPS{ 200 };
 	static const float DIST_THRESHOLD;
+	static const float NORMAL_EPSILON;
 	static const float MAX_DISTANCE;
+	static const float MARCH_RELAXATION;
+	static const float SDF_CACHE_VOXEL;
+	static const float SHADOW_BIAS;
+
+	// Object with an SDF, resolved in beginFrame()
+	struct SDFPrim
+	{
+		int index_m;
+		bool static_m;
+		bool bounded_m;
+		glm::vec3 center_m;
+		float radius_m;
+	};
 
 	RenderCam renderCam_m;
-	ofImage image_m;
+	int width_m = DEFAULT_WIDTH;
+	int height_m = DEFAULT_HEIGHT;
+	// RGB in [0, 1], three floats per pixel, top row first. Holds
+	// rows h in [frameH0, frameH1): the whole image, or one band of
+	// it when streaming to an ImageSink.
+	std::vector<float> framebuffer_m;
+	int frameH0_m = 0;
+	int frameH1_m = 0;
+	// Rows anti-aliasing refines. A streamed band is traced with a row
+	// of halo past each end, so edges on band seams are still found.
+	int bandH0_m = 0;
+	int bandH1_m = 0;
+	ImageSink::Depth outputDepth_m = ImageSink::DEPTH_8;
 	std::vector<SceneObject *> &scene_m;
 	std::vector<Light *> &lights_m;
 	Light* &ambientLight_m;
-	int nearestObj_m = -1;
+	SceneBVH sceneBVH_m;
+	// Created on the first parallel render, so renderers that only
+	// ever trace tiles handed to them don't each own a thread pool
+	std::unique_ptr<TileScheduler> scheduler_m;
+	bool parallel_m = true;
+	bool packets_m = false;
+	std::atomic<bool> cancel_m{ false };
+	RenderStats::Summary stats_m;
+	std::vector<SDFPrim> sdfPrims_m;
+	std::vector<int> sdfSlot_m;	// scene index -> sdfPrims_m index or -1
+	bool relaxedMarch_m = false;
+	int marchSteps_m = MAX_RAY_STEPS;
+	bool bakeStatic_m = false;
+	bool sdfCacheActive_m = false;
+	AABB bakeBounds_m{ glm::vec3(-12, -4, -12), glm::vec3(12, 8, 12) };
+	SDFCache sdfCache_m;
+	int aaGrid_m = 1;	// 1 means anti-aliasing is off
+	float aaThreshold_m = DEFAULT_AA_THRESHOLD;
+	// Rays traced per pixel over the whole image, top row first. Left
+	// empty by streamed renders unless sample counts are asked for.
+	std::vector<unsigned short> sampleCounts_m;
+	bool keepSampleCounts_m = false;
+
+	// Objects the rays of one tile hit, and where
+	struct TileDeps
+	{
+		std::vector<int> objects_m;
+		AABB hitBounds_m;
+
+		void add(int object, const glm::vec3 &point);
+	};
+
+	// The scene as a complete incremental render saw it
+	struct FrameHistory
+	{
+		bool valid_m = false;
+		uint64_t viewHash_m = 0;
+		std::vector<SceneObject *> objects_m;
+		std::vector<uint64_t> objectHashes_m;
+		std::vector<AABB> objectBounds_m;	// world space, invalid if unbounded
+	};
+
+	bool incremental_m = false;
+	// True while a frame is traced that a later one may build on
+	bool tracking_m = false;
+	FrameHistory history_m;
+	FrameHistory pending_m;
+	// By tile, in getFrameTiles() order
+	std::vector<TileDeps> tileDeps_m;
+	// The image before anti-aliasing, kept for the next incremental render
+	std::vector<float> unrefined_m;
+	// Where the tile a thread is tracing records its hits, if anywhere
+	static thread_local TileDeps *recording_t;
 
 public:
 	Renderer(std::vector<SceneObject *> &scene, std::vector<Light *> &lights, Light* &ambientLight) :
@@ -37,17 +145,160 @@ public:
 		ambientLight_m{ ambientLight }
 	{
 	}
-	void render(std::string filename, RenderMethod rend);
 
-	bool inShadow(Ray pointToLight, glm::vec3 lightPos);
-	ofColor phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse, const ofColor specular, float power, RenderMethod rend);
-	float sceneSDF(const glm::vec3 &p);
+	// Returns false if the image could not be saved. Prints a
+	// summary of where the time went, also kept in getStats().
+	// PNG, PPM and PFM files are streamed through renderToSink(),
+	// other formats are saved from the whole framebuffer.
+	bool render(std::string filename, RenderMethod rend);
+	// Trace the image in bands of TILE_SIZE rows and hand each band
+	// to sink once it is done, so only one band is held at a time.
+	// Afterwards the framebuffer holds the last band. Returns false
+	// if cancelled or the sink failed.
+	bool renderToSink(ImageSink &sink, RenderMethod rend);
+	// Bits per channel render() writes where the format allows it
+	void setOutputDepth(ImageSink::Depth depth) { outputDepth_m = depth; }
+	const RenderStats::Summary &getStats() const { return stats_m; }
+	// Trace the whole image into the framebuffer, without saving it
+	void renderFrame(RenderMethod rend);
+	RenderCam& getCamera() { return renderCam_m; }
+
+	// Render in passes of halving stride, calling onPass after each.
+	// A pass traces only pixels no earlier pass has traced and fills
+	// the block each one covers, so every pixel is traced once and the
+	// last pass leaves the same image as render(). Returns false if
+	// cancelled. Primary rays are not packet traced here.
+	//
+	// beginFrame() must be called first. After that the scene is only
+	// read, so this may run on another thread as long as the scene is
+	// not changed until it returns.
+	bool renderProgressive(RenderMethod rend, const PassFunc &onPass);
+	// Safe to call from any thread. A running renderProgressive()
+	// stops once the tiles already started are done.
+	void cancel() { cancel_m = true; }
+
+	// Takes effect on the next render. The view plane keeps its
+	// height and is widened or narrowed to the new aspect ratio.
+	void setResolution(int width, int height);
+	int getWidth() const { return width_m; }
+	int getHeight() const { return height_m; }
+
+	// render() in steps, for callers that schedule the tiles
+	// themselves: beginFrame() sizes the framebuffer and resolves the
+	// scene, then renderTile() may be called concurrently for
+	// disjoint tiles, and the framebuffer holds the result.
+	void beginFrame();
+	void renderTile(const Tile &tile, RenderMethod rend);
+	const std::vector<float> &getFramebuffer() const { return framebuffer_m; }
+	// 8 bit copy of the framebuffer, for saving
+	void getPixels(ofPixels &pixels) const;
+	int getFrameRows() const { return frameH1_m - frameH0_m; }
+
+	MemoryUsage getMemoryUsage() const;
+	// Framebuffer size for a resolution, to size jobs before rendering
+	static size_t getFramebufferSize(int width, int height) { return static_cast<size_t>(width) * height * 3 * sizeof(float); }
+
+	// Parallel mode splits the image into tiles and traces them on
+	// every core; serial mode keeps the original single-threaded loop.
+	// Both produce the same image.
+	void setParallel(bool parallel) { parallel_m = parallel; }
+	bool isParallel() const { return parallel_m; }
+
+	// Over-relaxed sphere tracing for RAY_MARCH: steps overshoot the
+	// distance bound by MARCH_RELAXATION and fall back to plain steps
+	// once they overshoot or land inside a surface. Hits are still taken
+	// within the hit threshold of the surface, but not at the same point
+	// as plain marching, so the image differs slightly.
+	void setRelaxedMarch(bool relaxed) { relaxedMarch_m = relaxed; }
+	bool isRelaxedMarch() const { return relaxedMarch_m; }
+	// Bake the SDF of static objects (SceneObject::isStatic) into a
+	// sparse grid over bakeBounds, kept in data/sdfcache/ and reused
+	// for as long as those objects don't change. Ray marching reads
+	// the grid and only evaluates static objects near their surface.
+	void setBakedSDF(bool bake) { bakeStatic_m = bake; }
+	bool isBakedSDF() const { return bakeStatic_m; }
+	void setBakedSDFBounds(const AABB &bounds) { bakeBounds_m = bounds; }
+
+	// Adaptive anti-aliasing. After one ray per pixel, pixels whose
+	// color differs from a neighbour's by more than threshold (largest
+	// channel difference, 0 to 1) are traced again with 2x2 jittered
+	// samples, and with maxSamples stratified samples where those still
+	// disagree. maxSamples is rounded to a square; 1 turns it off.
+	void setAntialiasing(int maxSamples, float threshold = DEFAULT_AA_THRESHOLD);
+	int getAntialiasing() const { return aaGrid_m * aaGrid_m; }
+	// Rays traced per pixel in the last render as a gray image,
+	// black for one ray and white for the most a pixel can take.
+	// Renders streamed to a file only count them if asked to.
+	void setKeepSampleCounts(bool keep) { keepSampleCounts_m = keep; }
+	void getSampleCountPixels(ofPixels &pixels) const;
+
+	// Most sceneSDF steps a marched ray may take
+	void setMarchStepBudget(int steps) { marchSteps_m = std::max(1, steps); }
+	int getMarchStepBudget() const { return marchSteps_m; }
+
+	// Incremental rendering (RAY_TRACE only). Each render remembers
+	// which objects every tile's rays hit and where. When the next
+	// render starts from the same view, only tiles that an edited object
+	// was or now is seen in, or may cast a shadow on, are traced again;
+	// the rest of the image is kept. Adding or removing objects, moving
+	// the camera or lights, or editing a plane re-traces everything.
+	void setIncremental(bool incremental) { incremental_m = incremental; }
+	bool isIncremental() const { return incremental_m; }
+
+	// Trace primary rays in SIMD packets of PACKET_SIZE (RAY_TRACE only)
+	void setPacketTracing(bool packets) { packets_m = packets; }
+	bool isPacketTracing() const { return packets_m; }
+
+	// nearestObj is per-ray state: the index of the object that was hit,
+	// kept out of the Renderer so that rays can be traced concurrently.
+	bool inShadow(Ray pointToLight, glm::vec3 lightPos, int nearestObj);
+	ofColor phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse, const ofColor specular, float power, RenderMethod rend, int nearestObj);
+	float sceneSDF(const glm::vec3 &p, int &nearestObj);
 	void draw() { renderCam_m.draw(); }
 
 private:
-	bool rayTraceHit(Ray r, glm::vec3 &nearestPoint, glm::vec3 &nearestNormal);
-	bool rayMarchHit(Ray r, glm::vec3 &nearestPoint, glm::vec3 &nearestNormal);
-	glm::vec3 getNormalRM(const glm::vec3 &nearestPoint);
+	void prepareScene();
+	void setFrameRows(int h0, int h1, int halo = 0);
+	std::vector<Tile> getFrameTiles() const;
+	void traceFrame(RenderMethod rend);
+	// Tiles to trace and to anti-alias this frame: all of them, or for
+	// an incremental render only those that edits since the last affect
+	void selectTiles(RenderMethod rend, std::vector<Tile> &traced, std::vector<Tile> &refined);
+	void snapshotScene(FrameHistory &state, RenderMethod rend);
+	bool findDirtyTiles(const std::vector<Tile> &tiles, std::vector<char> &dirty);
+	// Pixels box covers on screen, padded by one. False if part of it
+	// is behind the camera.
+	bool projectBounds(const AABB &box, int &w0, int &h0, int &w1, int &h1);
+	int tileIndex(const Tile &tile) const { return ((tile.y0 - frameH0_m) / TILE_SIZE) * ((width_m + TILE_SIZE - 1) / TILE_SIZE) + tile.x0 / TILE_SIZE; }
+	void recordTile(const Tile &tile, bool clear);
+	void finishFrame(int traced);
+	void renderTilePackets(const Tile &tile);
+	void renderTileProgressive(const Tile &tile, RenderMethod rend, int stride);
+	void runTiles(const std::vector<Tile> &tiles, const TileScheduler::TileFunc &func);
+	Ray getPixelRay(int w, int h);
+	// x and y are in pixels, (w + 0.5, h + 0.5) being the center of pixel w, h
+	Ray getSampleRay(float x, float y);
+	// h counts rows up from the bottom, like the view plane's v
+	size_t pixelIndex(int w, int h) const { return static_cast<size_t>(frameH1_m - h - 1) * width_m + w; }
+	void setPixel(int w, int h, const ofColor &color)
+	{
+		float *p = &framebuffer_m[3 * pixelIndex(w, h)];
+		p[0] = color.r / 255.0f;
+		p[1] = color.g / 255.0f;
+		p[2] = color.b / 255.0f;
+	}
+	ofColor renderPixel(int w, int h, RenderMethod rend);
+	ofColor traceRay(const Ray &ray, RenderMethod rend);
+	void refineFrame(RenderMethod rend, const std::vector<Tile> &traced, const std::vector<Tile> &refined);
+	void refineTile(const Tile &tile, const std::vector<float> &base, RenderMethod rend);
+	glm::vec3 supersample(int w, int h, int grid, RenderMethod rend, float &spread);
+	bool rayTraceHit(Ray r, glm::vec3 &nearestPoint, glm::vec3 &nearestNormal, int &nearestObj);
+	bool rayMarchHit(Ray r, glm::vec3 &nearestPoint, glm::vec3 &nearestNormal, int &nearestObj);
+	bool relaxedMarchHit(Ray r, glm::vec3 &nearestPoint, glm::vec3 &nearestNormal, int &nearestObj);
+	void updateSDFPrims();
+	void updateSDFCache();
+	float staticSDF(const glm::vec3 &p, int &nearestObj);
+	glm::vec3 getNormalRM(const glm::vec3 &nearestPoint, int nearestObj);
 };
 
 
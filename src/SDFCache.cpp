@@ -0,0 +1,132 @@
+#include "SDFCache.h"
+
+#include <chrono>
+#include <fstream>
+
+void SDFCache::build(uint64_t key, const AABB &bounds, float voxelSize, const DistanceFunc &sdf)
+{
+	auto start = std::chrono::steady_clock::now();
+	clear();
+	key_m = key;
+	bounds_m = bounds;
+	voxelSize_m = voxelSize;
+
+	float brickSize = voxelSize * BRICK_SIZE;
+	for (int a = 0; a < 3; a++)
+		brickCount_m[a] = std::max(1, static_cast<int>(std::ceil((bounds.max_m[a] - bounds.min_m[a]) / brickSize)));
+	float halfDiagonal = glm::length(glm::vec3(brickSize)) / 2;
+
+	bricks_m.resize(static_cast<size_t>(brickCount_m.x) * brickCount_m.y * brickCount_m.z);
+	for (int z = 0; z < brickCount_m.z; z++) {
+		for (int y = 0; y < brickCount_m.y; y++) {
+			for (int x = 0; x < brickCount_m.x; x++) {
+				glm::vec3 corner = bounds.min_m + glm::vec3(x, y, z) * brickSize;
+				Brick &brick = bricks_m[(z * brickCount_m.y + y) * brickCount_m.x + x];
+				brick.distance_m = sdf(corner + brickSize / 2, brick.object_m);
+				brick.offset_m = -1;
+
+				// Coarse bricks must still give a step of at least a brick
+				if (brick.distance_m - halfDiagonal >= brickSize)
+					continue;
+
+				brick.offset_m = static_cast<int>(samples_m.size());
+				for (int k = 0; k <= BRICK_SIZE; k++) {
+					for (int j = 0; j <= BRICK_SIZE; j++) {
+						for (int i = 0; i <= BRICK_SIZE; i++) {
+							int object;
+							samples_m.push_back(sdf(corner + glm::vec3(i, j, k) * voxelSize, object));
+						}
+					}
+				}
+			}
+		}
+	}
+
+	buildTimeMs_m = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void SDFCache::clear()
+{
+	key_m = 0;
+	brickCount_m = glm::ivec3(0);
+	bricks_m.clear();
+	samples_m.clear();
+}
+
+// Header, brick table, then the dense samples, all in native byte order
+bool SDFCache::save(const std::string &path) const
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+
+	uint32_t header[2] = { FILE_MAGIC, FILE_VERSION };
+	uint64_t brickTotal = bricks_m.size();
+	uint64_t sampleTotal = samples_m.size();
+	file.write(reinterpret_cast<const char *>(header), sizeof(header));
+	file.write(reinterpret_cast<const char *>(&key_m), sizeof(key_m));
+	file.write(reinterpret_cast<const char *>(&bounds_m), sizeof(bounds_m));
+	file.write(reinterpret_cast<const char *>(&voxelSize_m), sizeof(voxelSize_m));
+	file.write(reinterpret_cast<const char *>(&brickCount_m), sizeof(brickCount_m));
+	file.write(reinterpret_cast<const char *>(&brickTotal), sizeof(brickTotal));
+	file.write(reinterpret_cast<const char *>(&sampleTotal), sizeof(sampleTotal));
+	file.write(reinterpret_cast<const char *>(bricks_m.data()), brickTotal * sizeof(Brick));
+	file.write(reinterpret_cast<const char *>(samples_m.data()), sampleTotal * sizeof(float));
+	return static_cast<bool>(file);
+}
+
+bool SDFCache::load(const std::string &path, uint64_t key)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+
+	uint32_t header[2];
+	uint64_t fileKey;
+	file.read(reinterpret_cast<char *>(header), sizeof(header));
+	file.read(reinterpret_cast<char *>(&fileKey), sizeof(fileKey));
+	if (!file || header[0] != FILE_MAGIC || header[1] != FILE_VERSION || fileKey != key)
+		return false;
+
+	AABB bounds;
+	float voxelSize;
+	glm::ivec3 brickCount;
+	uint64_t brickTotal, sampleTotal;
+	file.read(reinterpret_cast<char *>(&bounds), sizeof(bounds));
+	file.read(reinterpret_cast<char *>(&voxelSize), sizeof(voxelSize));
+	file.read(reinterpret_cast<char *>(&brickCount), sizeof(brickCount));
+	file.read(reinterpret_cast<char *>(&brickTotal), sizeof(brickTotal));
+	file.read(reinterpret_cast<char *>(&sampleTotal), sizeof(sampleTotal));
+	if (!file || brickTotal != static_cast<uint64_t>(brickCount.x) * brickCount.y * brickCount.z || sampleTotal % BRICK_SAMPLES)
+		return false;
+
+	std::vector<Brick> bricks(brickTotal);
+	std::vector<float> samples(sampleTotal);
+	file.read(reinterpret_cast<char *>(bricks.data()), brickTotal * sizeof(Brick));
+	file.read(reinterpret_cast<char *>(samples.data()), sampleTotal * sizeof(float));
+	if (!file)
+		return false;
+	for (const Brick &brick : bricks) {
+		if (brick.offset_m >= 0 && brick.offset_m + static_cast<uint64_t>(BRICK_SAMPLES) > sampleTotal)
+			return false;
+	}
+
+	key_m = key;
+	bounds_m = bounds;
+	voxelSize_m = voxelSize;
+	brickCount_m = brickCount;
+	bricks_m.swap(bricks);
+	samples_m.swap(samples);
+	buildTimeMs_m = 0;
+	return true;
+}
+
+uint64_t SDFCache::hash(uint64_t h, const void *data, size_t size)
+{
+	const unsigned char *bytes = static_cast<const unsigned char *>(data);
+	for (size_t i = 0; i < size; i++) {
+		h ^= bytes[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
@@ -0,0 +1,105 @@
+#ifndef SDFCACHE_H
+#define SDFCACHE_H
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "ofMain.h"
+#include "BVH.h"
+
+// Distance field of a set of objects baked into a sparse brick grid.
+//
+// The bounds are cut into bricks of BRICK_SIZE^3 voxels. Bricks near a
+// surface store (BRICK_SIZE + 1)^3 distance samples and are sampled
+// trilinearly. Every other brick only keeps the distance at its center,
+// and sample() returns that minus the distance to the center, a lower
+// bound that is safe to sphere trace with.
+class SDFCache
+{
+public:
+	static const int BRICK_SIZE{ 8 };
+
+	// Distance at p and the index of the nearest object
+	typedef std::function<float(const glm::vec3 &p, int &object)> DistanceFunc;
+
+private:
+	static const int BRICK_SAMPLES{ (BRICK_SIZE + 1) * (BRICK_SIZE + 1) * (BRICK_SIZE + 1) };
+	static const uint32_t FILE_MAGIC{ 0x43465453 };	// "STFC"
+	static const uint32_t FILE_VERSION{ 1 };
+
+	struct Brick
+	{
+		int offset_m;		// into samples_m, -1 if only the center is kept
+		float distance_m;	// at the brick center
+		int object_m;		// nearest object at the brick center
+	};
+
+	uint64_t key_m = 0;
+	AABB bounds_m;
+	float voxelSize_m = 0;
+	glm::ivec3 brickCount_m{ 0 };
+	std::vector<Brick> bricks_m;
+	std::vector<float> samples_m;
+	float buildTimeMs_m = 0;
+
+public:
+	// key identifies what was baked, so a stale file is never loaded
+	void build(uint64_t key, const AABB &bounds, float voxelSize, const DistanceFunc &sdf);
+	bool load(const std::string &path, uint64_t key);
+	bool save(const std::string &path) const;
+	void clear();
+
+	bool empty() const { return bricks_m.empty(); }
+	uint64_t getKey() const { return key_m; }
+	float getVoxelSize() const { return voxelSize_m; }
+	int getDenseBrickCount() const { return static_cast<int>(samples_m.size() / BRICK_SAMPLES); }
+	float getBuildTime() const { return buildTimeMs_m; }
+	size_t getMemoryUsage() const { return bricks_m.capacity() * sizeof(Brick) + samples_m.capacity() * sizeof(float); }
+
+	// FNV-1a, for building keys
+	static uint64_t hash(uint64_t h, const void *data, size_t size);
+
+	// False if p is outside the baked bounds
+	bool sample(const glm::vec3 &p, float &distance, int &object) const
+	{
+		if (bricks_m.empty())
+			return false;
+		glm::vec3 cell = (p - bounds_m.min_m) / voxelSize_m;
+		glm::ivec3 brick;
+		for (int a = 0; a < 3; a++) {
+			brick[a] = static_cast<int>(std::floor(cell[a] / BRICK_SIZE));
+			if (brick[a] < 0 || brick[a] >= brickCount_m[a])
+				return false;
+		}
+
+		const Brick &b = bricks_m[(brick.z * brickCount_m.y + brick.y) * brickCount_m.x + brick.x];
+		object = b.object_m;
+		if (b.offset_m < 0) {
+			glm::vec3 center = bounds_m.min_m + glm::vec3(brick.x + 0.5f, brick.y + 0.5f, brick.z + 0.5f) * (voxelSize_m * BRICK_SIZE);
+			distance = b.distance_m - glm::length(p - center);
+			return true;
+		}
+
+		// Voxel within the brick and the position inside that voxel
+		int i[3];
+		float f[3];
+		for (int a = 0; a < 3; a++) {
+			float local = std::min(cell[a] - brick[a] * BRICK_SIZE, BRICK_SIZE - 0.001f);
+			i[a] = static_cast<int>(local);
+			f[a] = local - i[a];
+		}
+		const float *s = &samples_m[b.offset_m];
+		auto at = [s](int x, int y, int z) { return s[(z * (BRICK_SIZE + 1) + y) * (BRICK_SIZE + 1) + x]; };
+		float x00 = glm::mix(at(i[0], i[1], i[2]), at(i[0] + 1, i[1], i[2]), f[0]);
+		float x10 = glm::mix(at(i[0], i[1] + 1, i[2]), at(i[0] + 1, i[1] + 1, i[2]), f[0]);
+		float x01 = glm::mix(at(i[0], i[1], i[2] + 1), at(i[0] + 1, i[1], i[2] + 1), f[0]);
+		float x11 = glm::mix(at(i[0], i[1] + 1, i[2] + 1), at(i[0] + 1, i[1] + 1, i[2] + 1), f[0]);
+		distance = glm::mix(glm::mix(x00, x10, f[1]), glm::mix(x01, x11, f[1]), f[2]) - voxelSize_m * 1.7320508f;
+		return true;
+	}
+};
+
+#endif
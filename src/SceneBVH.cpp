@@ -0,0 +1,202 @@
+#include "SceneBVH.h"
+#include "RenderStats.h"
+
+#include <algorithm>
+
+#include <glm/gtc/type_ptr.hpp>
+
+void SceneBVH::update(const std::vector<SceneObject *> &objs)
+{
+	scene_m.compile(objs);
+
+	std::vector<AABB> bounds;
+	std::vector<int> boundedIndex;
+	std::vector<int> unbounded;
+	for (int i = 0; i < scene_m.size(); i++) {
+		if (scene_m.getPrim(i).kind_m == RenderScene::PLANE)
+			continue;
+		AABB primBounds = scene_m.getWorldBounds(i);
+		if (primBounds.valid()) {
+			bounds.push_back(primBounds);
+			boundedIndex.push_back(i);
+		}
+		else unbounded.push_back(i);
+	}
+
+	// A joint that gains a connector shifts the primitives, so
+	// compare those as well as the object list.
+	if (objs != objects_m || boundedIndex != boundedIndex_m) {
+		objects_m = objs;
+		bounds_m.swap(bounds);
+		boundedIndex_m.swap(boundedIndex);
+		unbounded_m.swap(unbounded);
+		bvh_m.build(bounds_m);
+		return;
+	}
+
+	bool moved = false;
+	for (int i = 0; i < bounds.size(); i++) {
+		if (bounds[i].min_m != bounds_m[i].min_m || bounds[i].max_m != bounds_m[i].max_m) {
+			bounds_m[i] = bounds[i];
+			moved = true;
+		}
+	}
+	unbounded_m.swap(unbounded);
+	if (moved)
+		bvh_m.refit(bounds_m);
+}
+
+size_t SceneBVH::getMemoryUsage() const
+{
+	return bvh_m.getMemoryUsage()
+		+ scene_m.getMemoryUsage()
+		+ objects_m.capacity() * sizeof(SceneObject *)
+		+ bounds_m.capacity() * sizeof(AABB)
+		+ (boundedIndex_m.capacity() + unbounded_m.capacity()) * sizeof(int);
+}
+
+bool SceneBVH::intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal, int &index) const
+{
+	glm::vec3 intersectPoint;
+	glm::vec3 intersectNormal;
+	float nearestDistance = std::numeric_limits<float>::max();
+	index = -1;
+
+	auto test = [&](int prim, float &tMax) {
+		float dist;
+		if (scene_m.intersect(prim, ray, dist, intersectPoint, intersectNormal) && tMax > dist) {
+			tMax = dist;
+			index = scene_m.getPrim(prim).object_m;
+			point = intersectPoint;
+			normal = intersectNormal;
+			return true;
+		}
+		return false;
+	};
+
+	scene_m.intersectPlanes(ray, nearestDistance, index, point, normal);
+	for (int prim : unbounded_m)
+		test(prim, nearestDistance);
+	bvh_m.traverse(ray.getPosition(), ray.getDirection(), nearestDistance, [&](int prim, float &tMax) {
+		return test(boundedIndex_m[prim], tMax);
+	});
+	return index >= 0;
+}
+
+bool SceneBVH::occluded(const Ray &ray, float maxDist, int skip) const
+{
+	if (scene_m.occludedPlanes(ray, maxDist, skip))
+		return true;
+	for (int prim : unbounded_m) {
+		if (scene_m.getPrim(prim).object_m != skip && scene_m.occluded(prim, ray, maxDist))
+			return true;
+	}
+	return bvh_m.traverseAny(ray.getPosition(), ray.getDirection(), maxDist, [&](int prim) {
+		int i = boundedIndex_m[prim];
+		return scene_m.getPrim(i).object_m != skip && scene_m.occluded(i, ray, maxDist);
+	});
+}
+
+void SceneBVH::allHits(const Ray &ray, std::vector<int> &hits) const
+{
+	glm::vec3 intersectPoint;
+	glm::vec3 intersectNormal;
+	float dist;
+
+	// Both primitives of a joint may be hit, report the joint once
+	auto add = [&](int prim) {
+		int object = scene_m.getPrim(prim).object_m;
+		if (std::find(hits.begin(), hits.end(), object) == hits.end())
+			hits.push_back(object);
+	};
+
+	for (int i = 0; i < scene_m.size(); i++) {
+		if (scene_m.getPrim(i).kind_m == RenderScene::PLANE && scene_m.intersect(i, ray, dist, intersectPoint, intersectNormal))
+			add(i);
+	}
+	for (int prim : unbounded_m) {
+		if (scene_m.intersect(prim, ray, dist, intersectPoint, intersectNormal))
+			add(prim);
+	}
+	float tMax = std::numeric_limits<float>::max();
+	bvh_m.traverse(ray.getPosition(), ray.getDirection(), tMax, [&](int prim, float &) {
+		if (scene_m.intersect(boundedIndex_m[prim], ray, dist, intersectPoint, intersectNormal))
+			add(boundedIndex_m[prim]);
+		return false;
+	});
+}
+
+void SceneBVH::intersectPacket(const RayPacket &packet, PacketHit &hit) const
+{
+	for (const RenderScene::PlanePrim &plane : scene_m.getPlanes()) {
+		RENDER_STATS_ADD(PACKET_TESTS, 1);
+		PacketKernels::intersectPlane(packet, hit, packet.activeMask_m, plane.point_m, plane.normal_m, plane.object_m, plane.prim_m);
+	}
+	for (int prim : unbounded_m)
+		intersectPacketPrim(packet, hit, packet.activeMask_m, prim);
+	if (bvh_m.empty() || !packet.activeMask_m)
+		return;
+
+	// Visit children in the order the first active ray wants them,
+	// the packet is coherent enough for that to suit all of it.
+	int lead = 0;
+	while (!((packet.activeMask_m >> lead) & 1))
+		lead++;
+	bool dirIsNeg[3] = { packet.dx_m[lead] < 0, packet.dy_m[lead] < 0, packet.dz_m[lead] < 0 };
+
+	const std::vector<BVHNode> &nodes = bvh_m.getNodes();
+	const std::vector<int> &prims = bvh_m.getPrimIndices();
+	int stack[BVH::MAX_DEPTH];
+	int stackSize = 0;
+	int current = 0;
+	while (true) {
+		const BVHNode &node = nodes[current];
+		int mask = PacketKernels::intersectBox(packet, hit, node.bounds_m, packet.activeMask_m);
+		if (mask) {
+			if (node.count_m > 0) {
+				for (int i = 0; i < node.count_m; i++)
+					intersectPacketPrim(packet, hit, mask, boundedIndex_m[prims[node.offset_m + i]]);
+				if (stackSize == 0) break;
+				current = stack[--stackSize];
+			}
+			else if (dirIsNeg[node.axis_m]) {
+				stack[stackSize++] = current + 1;
+				current = node.offset_m;
+			}
+			else {
+				stack[stackSize++] = node.offset_m;
+				current = current + 1;
+			}
+		}
+		else {
+			if (stackSize == 0) break;
+			current = stack[--stackSize];
+		}
+	}
+}
+
+// Spheres get the SIMD packet kernel, everything
+// else is tested one lane at a time.
+void SceneBVH::intersectPacketPrim(const RayPacket &packet, PacketHit &hit, int mask, int prim) const
+{
+	RENDER_STATS_ADD(PACKET_TESTS, 1);
+	const RenderScene::PrimRef &ref = scene_m.getPrim(prim);
+	if (ref.kind_m == RenderScene::SPHERE) {
+		const RenderScene::SpherePrim &sphere = scene_m.getSphere(ref.slot_m);
+		PacketKernels::intersectSphere(packet, hit, mask, glm::value_ptr(sphere.xf_m.inverse_m), sphere.radius_m, ref.object_m, prim);
+		return;
+	}
+
+	for (int lane = 0; lane < PACKET_SIZE; lane++) {
+		if (!((mask >> lane) & 1))
+			continue;
+		Ray ray = packet.getRay(lane);
+		glm::vec3 point, normal;
+		float dist;
+		if (scene_m.intersect(prim, ray, dist, point, normal) && dist < hit.t_m[lane]) {
+			hit.t_m[lane] = dist;
+			hit.obj_m[lane] = ref.object_m;
+			hit.prim_m[lane] = prim;
+		}
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef SCENEBVH_H
+#define SCENEBVH_H
+
+#include <vector>
+
+#include "ofMain.h"
+#include "BVH.h"
+#include "Ray.h"
+#include "RayPacket.h"
+#include "RenderScene.h"
+#include "SceneObject.h"
+
+// World space BVH over a list of SceneObjects.
+//
+// The objects are compiled into a RenderScene and the tree is built over
+// its primitives, so a Joint is two leaves. Planes are kept aside and
+// tested on every query in one loop over the plane array, as are other
+// unbounded objects. update() rebuilds the tree when the primitives
+// change and only refits the boxes when objects have moved. Queries
+// return indices into the list passed to update().
+class SceneBVH
+{
+private:
+	std::vector<SceneObject *> objects_m;
+	RenderScene scene_m;
+	std::vector<AABB> bounds_m;		// per bounded primitive
+	std::vector<int> boundedIndex_m;	// BVH primitive -> RenderScene primitive
+	std::vector<int> unbounded_m;		// RenderScene primitives other than planes
+	BVH bvh_m;
+
+public:
+	void update(const std::vector<SceneObject *> &objs);
+	const BVH& getBVH() const { return bvh_m; }
+	const RenderScene& getRenderScene() const { return scene_m; }
+	size_t getMemoryUsage() const;
+
+	// Nearest hit by distance from the ray origin
+	bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal, int &index) const;
+
+	// Is anything other than object skip hit no farther than maxDist?
+	bool occluded(const Ray &ray, float maxDist, int skip) const;
+
+	// Every object the ray hits, in no particular order
+	void allHits(const Ray &ray, std::vector<int> &hits) const;
+
+	// Nearest hit for each active lane of a ray packet
+	void intersectPacket(const RayPacket &packet, PacketHit &hit) const;
+
+private:
+	void intersectPacketPrim(const RayPacket &packet, PacketHit &hit, int mask, int prim) const;
+};
+
+#endif
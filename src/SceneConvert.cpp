@@ -0,0 +1,67 @@
+#include "SceneConvert.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "SceneFile.h"
+#include "SceneObject.h"
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	float elapsedMs(Clock::time_point start)
+	{
+		return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+	}
+}
+
+bool SceneConvert::requested(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; i++) {
+		if (!std::strcmp(argv[i], "--convert"))
+			return true;
+	}
+	return false;
+}
+
+int SceneConvert::run(int argc, char *argv[])
+{
+	std::string inPath;
+	std::string outPath;
+	for (int i = 1; i < argc; i++) {
+		if (!std::strcmp(argv[i], "--convert") && i + 2 < argc) {
+			inPath = argv[++i];
+			outPath = argv[++i];
+		}
+	}
+	if (inPath.empty()) {
+		std::cerr << "Usage: " << argv[0] << " --convert <input.so|input.sob> <output.so|output.sob>\n";
+		return BAD_ARGUMENTS;
+	}
+
+	std::vector<SceneObject *> objs;
+	int status = SUCCESS;
+	Clock::time_point start = Clock::now();
+	if (!SceneFile::load(ofToDataPath(inPath), objs)) {
+		std::cerr << inPath << " could not be opened for reading!\n";
+		status = SCENE_LOAD_FAILED;
+	}
+	else {
+		std::cout << "Loaded " << objs.size() << " objects from " << inPath << " in " << elapsedMs(start) << " ms\n";
+		start = Clock::now();
+		if (SceneFile::save(ofToDataPath(outPath), objs)) {
+			std::cout << "Saved " << outPath << " in " << elapsedMs(start) << " ms\n";
+		}
+		else {
+			std::cerr << outPath << " could not be saved!\n";
+			status = SCENE_SAVE_FAILED;
+		}
+	}
+
+	// Children come after their parents, so deleting from the back
+	// never has a deleted parent move its children around
+	for (auto it = objs.rbegin(); it != objs.rend(); ++it)
+		delete *it;
+	return status;
+}
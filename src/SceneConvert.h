@@ -0,0 +1,28 @@
+#ifndef SCENECONVERT_H
+#define SCENECONVERT_H
+
+// Conversion between the .so text and .sob binary scene formats,
+// run without a window like HeadlessRender.
+//
+// Usage: <app> --convert <input> <output>
+//
+// The format of each file is chosen by its extension, .sob being
+// binary and anything else text. Relative paths are resolved against
+// bin/data/. Both formats hold every object type; meshes without a
+// source file are left out of either with a warning.
+namespace SceneConvert
+{
+	enum ExitCode
+	{
+		SUCCESS = 0,
+		BAD_ARGUMENTS = 1,
+		SCENE_LOAD_FAILED = 2,
+		SCENE_SAVE_FAILED = 3,
+	};
+
+	// True if the arguments ask for a conversion
+	bool requested(int argc, char *argv[]);
+	int run(int argc, char *argv[]);
+}
+
+#endif
@@ -0,0 +1,1013 @@
+#include "SceneFile.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <typeinfo>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "binary scenes store vec3 as three packed floats");
+
+namespace
+{
+	const uint32_t BYTE_ORDER_MARK{ 0x01020304 };
+
+	bool isBinaryPath(const std::string &path)
+	{
+		return path.size() >= 4 && path.compare(path.size() - 4, 4, ".sob") == 0;
+	}
+
+	// objs ordered so that every object whose parent is also in objs
+	// comes after it, and the set of objs. Walks each hierarchy depth
+	// first with an explicit stack, children in order.
+	std::vector<SceneObject *> hierarchyOrder(const std::vector<SceneObject *> &objs, std::unordered_set<const SceneObject *> &included)
+	{
+		included.clear();
+		included.insert(objs.begin(), objs.end());
+		std::vector<SceneObject *> order;
+		std::vector<SceneObject *> stack;
+		order.reserve(objs.size());
+		for (SceneObject *root : objs) {
+			if (included.count(root->getParent()))
+				continue;
+			stack.push_back(root);
+			while (!stack.empty()) {
+				SceneObject *obj = stack.back();
+				stack.pop_back();
+				order.push_back(obj);
+				const std::vector<SceneObject *> &children = obj->getChildren();
+				for (auto it = children.rbegin(); it != children.rend(); ++it) {
+					if (included.count(*it))
+						stack.push_back(*it);
+				}
+			}
+		}
+		return order;
+	}
+
+	// Fills in the type and shape of rec. False for objects the
+	// binary format has no type for.
+	bool describe(SceneObject *obj, SceneFile::BinaryRecord &rec)
+	{
+		// Exact types only, like RenderScene
+		const std::type_info &type = typeid(*obj);
+		if (type == typeid(Joint)) {
+			rec.type_m = SceneFile::BINARY_JOINT;
+		}
+		else if (type == typeid(Sphere)) {
+			rec.type_m = SceneFile::BINARY_SPHERE;
+			rec.params_m[0] = static_cast<Sphere *>(obj)->getRadius();
+		}
+		else if (type == typeid(Cone)) {
+			const Cone *cone = static_cast<Cone *>(obj);
+			rec.type_m = SceneFile::BINARY_CONE;
+			rec.params_m[0] = cone->getRadius();
+			rec.params_m[1] = cone->getHeight();
+		}
+		else if (type == typeid(Plane)) {
+			const Plane *plane = static_cast<Plane *>(obj);
+			rec.type_m = SceneFile::BINARY_PLANE;
+			glm::vec3 normal = plane->getNormal();
+			glm::vec2 size = plane->getDrawSize();
+			rec.params_m[0] = normal.x;
+			rec.params_m[1] = normal.y;
+			rec.params_m[2] = normal.z;
+			rec.params_m[3] = size.x;
+			rec.params_m[4] = size.y;
+		}
+		else if (type == typeid(Light)) {
+			rec.type_m = SceneFile::BINARY_LIGHT;
+			rec.params_m[0] = static_cast<Light *>(obj)->getIntensity();
+		}
+		else if (type == typeid(Mesh)) {
+			if (static_cast<Mesh *>(obj)->getSource().empty())
+				return false;
+			rec.type_m = SceneFile::BINARY_MESH;
+		}
+		else {
+			return false;
+		}
+		return true;
+	}
+
+	// Keywords of the types in text scenes, by BinaryType
+	const char *const TYPE_KEYWORDS[] = { "-joint", "-sphere", "-cone", "-plane", "-mesh", "-light" };
+
+	// What createObject() gives a type when the file doesn't say,
+	// matching the class constructors
+	void defaultParams(uint8_t type, float *params)
+	{
+		const float plane[] = { 0, 1, 0, 20, 20 };
+		std::fill_n(params, 6, 0.0f);
+		switch (type)
+		{
+		case SceneFile::BINARY_SPHERE: params[0] = 1; break;
+		case SceneFile::BINARY_CONE: params[0] = 1; params[1] = 2; break;
+		case SceneFile::BINARY_PLANE: std::copy(plane, plane + 5, params); break;
+		case SceneFile::BINARY_LIGHT: params[0] = 0.8f; break;	// as a light added in the app
+		}
+	}
+
+	ofColor defaultDiffuse(uint8_t type)
+	{
+		switch (type)
+		{
+		case SceneFile::BINARY_SPHERE: return ofColor::lightGray;
+		case SceneFile::BINARY_PLANE: return ofColor::darkOliveGreen;
+		case SceneFile::BINARY_LIGHT: return ofColor::yellow;
+		default: return ofColor::gray;
+		}
+	}
+
+	// Meshes are loaded once per file and copied, so they share geometry
+	typedef std::unordered_map<std::string, std::unique_ptr<Mesh>> MeshCache;
+
+	// New object of a BinaryType with its shape and transform. Colors
+	// and the static flag are the type's defaults. Null for an unknown
+	// type or a mesh file that can't be read.
+	SceneObject* createObject(uint8_t type, const float *p, const std::string &source,
+		const glm::vec3 &pos, const glm::vec3 &rot, const glm::vec3 &sca, MeshCache &meshes)
+	{
+		SceneObject *obj;
+		switch (type)
+		{
+		case SceneFile::BINARY_JOINT:
+			obj = new Joint(pos, rot, sca);
+			break;
+		case SceneFile::BINARY_SPHERE:
+			obj = new Sphere(pos, p[0]);
+			break;
+		case SceneFile::BINARY_CONE:
+			obj = new Cone(pos, p[0], p[1]);
+			break;
+		case SceneFile::BINARY_PLANE:
+			obj = new Plane(pos, glm::vec3(p[0], p[1], p[2]), ofColor::darkOliveGreen, p[3], p[4]);
+			break;
+		case SceneFile::BINARY_LIGHT:
+			obj = new Light(pos, p[0]);
+			break;
+		case SceneFile::BINARY_MESH: {
+			auto it = meshes.find(source);
+			if (it == meshes.end()) {
+				// A failed load is cached too, so it is only reported once
+				ofMesh mesh;
+				std::unique_ptr<Mesh> prototype;
+				if (SceneFile::loadObj(ofToDataPath(source), mesh)) {
+					prototype.reset(new Mesh(glm::vec3(0, 0, 0), mesh));
+					prototype->setSource(source);
+				}
+				else {
+					std::cerr << source << " could not be opened for reading!\n";
+				}
+				it = meshes.emplace(source, std::move(prototype)).first;
+			}
+			if (!it->second)
+				return NULL;
+			obj = it->second->clone();
+			obj->setLocalPosition(pos);
+			break;
+		}
+		default:
+			return NULL;
+		}
+
+		if (type != SceneFile::BINARY_JOINT) {
+			obj->setLocalRotation(rot);
+			obj->setLocalScale(sca);
+		}
+		return obj;
+	}
+
+	void attachChild(SceneObject *parent, SceneObject *child)
+	{
+		parent->addChild(child);
+		// Joint::addChild only fits the connector to joint parents
+		Joint *joint = dynamic_cast<Joint *>(child);
+		if (joint && !dynamic_cast<Joint *>(parent))
+			joint->adjustConnector();
+	}
+
+	// printf("%f") digits for the usual range, written straight into
+	// out without the C library's locale and format parsing. out needs
+	// room for 64 characters. Returns the end of the number.
+	char* formatFloat(char *out, float value)
+	{
+		double v = value;
+		if (!(std::fabs(v) < 9.0e12))
+			return out + std::snprintf(out, 64, "%f", v);
+		if (std::signbit(v)) {
+			*out++ = '-';
+			v = -v;
+		}
+		// A float has at most 24 significant bits, so the fraction times
+		// 1e6 is exact in a double and rounds half to even like printf
+		double wholePart = std::floor(v);
+		double scaled = (v - wholePart) * 1e6;
+		uint64_t whole = static_cast<uint64_t>(wholePart);
+		uint64_t frac = static_cast<uint64_t>(scaled);
+		double rest = scaled - frac;
+		if (rest > 0.5 || (rest == 0.5 && (frac & 1)))
+			frac++;
+		if (frac == 1000000) {
+			whole++;
+			frac = 0;
+		}
+		char digits[20];
+		int count = 0;
+		do {
+			digits[count++] = static_cast<char>('0' + whole % 10);
+			whole /= 10;
+		} while (whole > 0);
+		while (count > 0)
+			*out++ = digits[--count];
+		*out++ = '.';
+		for (int i = 5; i >= 0; i--) {
+			out[i] = static_cast<char>('0' + frac % 10);
+			frac /= 10;
+		}
+		return out + 6;
+	}
+
+	// Text built in one reused buffer and handed to the stream in large
+	// blocks, so writing an object allocates nothing
+	class TextWriter
+	{
+	private:
+		static const size_t CAPACITY{ 1 << 16 };
+		static const size_t MAX_NUMBER{ 64 };
+		std::ostream &out_m;
+		std::vector<char> buffer_m;
+		size_t used_m = 0;
+
+	public:
+		TextWriter(std::ostream &out) : out_m{ out }, buffer_m(CAPACITY) {}
+		~TextWriter() { flush(); }
+
+		void flush()
+		{
+			out_m.write(buffer_m.data(), used_m);
+			used_m = 0;
+		}
+
+		void text(const char *str, size_t length)
+		{
+			if (used_m + length > CAPACITY)
+				flush();
+			if (length > CAPACITY) {
+				out_m.write(str, length);
+				return;
+			}
+			std::memcpy(&buffer_m[used_m], str, length);
+			used_m += length;
+		}
+		void text(const char *str) { text(str, std::strlen(str)); }
+		void text(const std::string &str) { text(str.data(), str.size()); }
+
+		void number(float value)
+		{
+			if (used_m + MAX_NUMBER > CAPACITY)
+				flush();
+			used_m = formatFloat(&buffer_m[used_m], value) - buffer_m.data();
+		}
+
+		// <vec3(x, y, z)>, the way glm::to_string writes it
+		void vector(const glm::vec3 &v)
+		{
+			text("<vec3(", 6);
+			number(v.x);
+			text(", ", 2);
+			number(v.y);
+			text(", ", 2);
+			number(v.z);
+			text(")>", 2);
+		}
+
+		// <r, g, b>
+		void color(const ofColor &c)
+		{
+			char rgb[16];
+			int length = std::snprintf(rgb, sizeof(rgb), "<%d, %d, %d>", c.r, c.g, c.b);
+			text(rgb, length);
+		}
+	};
+
+	uint64_t alignSection(uint64_t offset)
+	{
+		return (offset + 15) & ~static_cast<uint64_t>(15);
+	}
+
+	// Zero pad up to offset, then write bytes
+	void writeSection(std::ofstream &outF, uint64_t &written, uint64_t offset, const void *data, size_t bytes)
+	{
+		static const char zeros[16] = {};
+		outF.write(zeros, offset - written);
+		outF.write(static_cast<const char *>(data), bytes);
+		written = offset + bytes;
+	}
+
+	// Cursor over a text scene held in memory, counting lines and
+	// columns for error messages. The text must end in a zero.
+	class TextCursor
+	{
+	private:
+		const char *p_m;
+		const char *end_m;
+		const char *lineStart_m;
+		int line_m = 1;
+
+	public:
+		TextCursor(const char *begin, const char *end) : p_m{ begin }, end_m{ end }, lineStart_m{ begin } {}
+
+		int getLine() const { return line_m; }
+		int getColumn() const { return static_cast<int>(p_m - lineStart_m) + 1; }
+
+		// False once only whitespace is left
+		bool skipSpace()
+		{
+			for (; p_m < end_m && std::isspace(static_cast<unsigned char>(*p_m)); p_m++) {
+				if (*p_m == '\n') {
+					line_m++;
+					lineStart_m = p_m + 1;
+				}
+			}
+			return p_m < end_m;
+		}
+
+		void skipLine()
+		{
+			while (p_m < end_m && *p_m != '\n')
+				p_m++;
+		}
+
+		bool accept(char c)
+		{
+			skipSpace();
+			if (p_m < end_m && *p_m == c) {
+				p_m++;
+				return true;
+			}
+			return false;
+		}
+
+		// word, not followed by more letters or digits
+		bool acceptWord(const char *word)
+		{
+			skipSpace();
+			size_t length = std::strlen(word);
+			if (static_cast<size_t>(end_m - p_m) < length || std::strncmp(p_m, word, length) != 0
+				|| std::isalnum(static_cast<unsigned char>(p_m[length])) || p_m[length] == '_')
+				return false;
+			p_m += length;
+			return true;
+		}
+
+		// Up to the next whitespace, ';', '<' or '>'
+		bool readName(const char *&name, size_t &length)
+		{
+			skipSpace();
+			name = p_m;
+			while (p_m < end_m && isNameChar(*p_m))
+				p_m++;
+			length = p_m - name;
+			return length > 0;
+		}
+
+		bool readFloat(float &value)
+		{
+			skipSpace();
+			char *end;
+			value = std::strtof(p_m, &end);
+			if (end == p_m || end > end_m)
+				return false;
+			p_m = end;
+			return true;
+		}
+
+	private:
+		static bool isNameChar(char c)
+		{
+			return c != '\0' && c != ';' && c != '<' && c != '>' && !std::isspace(static_cast<unsigned char>(c));
+		}
+	};
+
+	// create -<type> <name> [-rotate <v>] [-translate <v>] [-parent <name>]
+	//     [-scale <v>] [-diffuse <v>] [-specular <v>] [-static 0|1] [shape options];
+	// Names point into the text.
+	struct TextStatement
+	{
+		uint8_t type_m;
+		const char *name_m;
+		size_t nameLength_m;
+		const char *parent_m;
+		size_t parentLength_m;	// 0 for none
+		int parentLine_m;
+		int parentColumn_m;
+		const char *source_m;
+		size_t sourceLength_m;
+		glm::vec3 rotate_m;
+		glm::vec3 translate_m;
+		glm::vec3 scale_m;
+		float params_m[6];		// as in SceneFile::BinaryRecord
+		// Colors as 0 to 255 per channel, type defaults unless given
+		glm::vec3 diffuse_m;
+		glm::vec3 specular_m;
+		bool hasDiffuse_m;
+		bool hasSpecular_m;
+		bool hasStatic_m;
+		bool static_m;
+	};
+
+	// <vec3(x, y, z)>, or <x, y, z>
+	bool parseVector(TextCursor &cursor, glm::vec3 &v, std::string &error)
+	{
+		if (!cursor.accept('<')) {
+			error = "expected '<'";
+			return false;
+		}
+		bool wrapped = cursor.acceptWord("vec3");
+		if (wrapped && !cursor.accept('(')) {
+			error = "expected '(' after vec3";
+			return false;
+		}
+		for (int i = 0; i < 3; i++) {
+			if ((i > 0 && !cursor.accept(',')) || !cursor.readFloat(v[i])) {
+				error = "expected three numbers separated by commas";
+				return false;
+			}
+		}
+		if ((wrapped && !cursor.accept(')')) || !cursor.accept('>')) {
+			error = wrapped ? "expected ')>'" : "expected '>'";
+			return false;
+		}
+		return true;
+	}
+
+	bool parseNumber(TextCursor &cursor, float &value, std::string &error)
+	{
+		if (!cursor.readFloat(value)) {
+			error = "expected a number";
+			return false;
+		}
+		return true;
+	}
+
+	// Shape options only belong to some types
+	bool checkApplies(bool applies, const char *option, const TextStatement &st, std::string &error)
+	{
+		if (!applies)
+			error = std::string(option) + " does not apply to " + (TYPE_KEYWORDS[st.type_m] + 1) + " objects";
+		return applies;
+	}
+
+	// Options may come in any order. On failure the cursor is left
+	// where the error is.
+	bool parseStatement(TextCursor &cursor, TextStatement &st, std::string &error)
+	{
+		using namespace SceneFile;
+		if (!cursor.acceptWord("create")) {
+			error = "expected 'create'";
+			return false;
+		}
+		const uint8_t typeCount = sizeof(TYPE_KEYWORDS) / sizeof(TYPE_KEYWORDS[0]);
+		for (st.type_m = 0; st.type_m < typeCount && !cursor.acceptWord(TYPE_KEYWORDS[st.type_m]); st.type_m++)
+			;
+		if (st.type_m == typeCount) {
+			error = "expected an object type: -joint, -sphere, -cone, -plane, -mesh or -light";
+			return false;
+		}
+		if (!cursor.readName(st.name_m, st.nameLength_m)) {
+			error = "expected an object name";
+			return false;
+		}
+
+		uint8_t type = st.type_m;
+		st.parentLength_m = 0;
+		st.source_m = "";
+		st.sourceLength_m = 0;
+		st.rotate_m = glm::vec3(0, 0, 0);
+		st.translate_m = glm::vec3(0, 0, 0);
+		st.scale_m = glm::vec3(1, 1, 1);
+		defaultParams(type, st.params_m);
+		st.hasDiffuse_m = false;
+		st.hasSpecular_m = false;
+		st.hasStatic_m = false;
+		while (!cursor.accept(';')) {
+			bool parsed;
+			if (cursor.acceptWord("-rotate")) {
+				parsed = parseVector(cursor, st.rotate_m, error);
+			}
+			else if (cursor.acceptWord("-translate")) {
+				parsed = parseVector(cursor, st.translate_m, error);
+			}
+			else if (cursor.acceptWord("-scale")) {
+				parsed = parseVector(cursor, st.scale_m, error);
+			}
+			else if (cursor.acceptWord("-parent")) {
+				cursor.skipSpace();
+				st.parentLine_m = cursor.getLine();
+				st.parentColumn_m = cursor.getColumn();
+				parsed = cursor.readName(st.parent_m, st.parentLength_m);
+				if (!parsed)
+					error = "expected a parent name";
+				else if (st.parentLength_m == 4 && std::strncmp(st.parent_m, "NULL", 4) == 0)
+					st.parentLength_m = 0;
+			}
+			else if (cursor.acceptWord("-diffuse")) {
+				parsed = st.hasDiffuse_m = parseVector(cursor, st.diffuse_m, error);
+			}
+			else if (cursor.acceptWord("-specular")) {
+				parsed = st.hasSpecular_m = parseVector(cursor, st.specular_m, error);
+			}
+			else if (cursor.acceptWord("-static")) {
+				st.static_m = cursor.acceptWord("1");
+				parsed = st.hasStatic_m = st.static_m || cursor.acceptWord("0");
+				if (!parsed)
+					error = "expected 0 or 1";
+			}
+			else if (cursor.acceptWord("-radius")) {
+				parsed = checkApplies(type == BINARY_SPHERE || type == BINARY_CONE, "-radius", st, error)
+					&& parseNumber(cursor, st.params_m[0], error);
+			}
+			else if (cursor.acceptWord("-height")) {
+				parsed = checkApplies(type == BINARY_CONE || type == BINARY_PLANE, "-height", st, error)
+					&& parseNumber(cursor, st.params_m[type == BINARY_CONE ? 1 : 4], error);
+			}
+			else if (cursor.acceptWord("-width")) {
+				parsed = checkApplies(type == BINARY_PLANE, "-width", st, error)
+					&& parseNumber(cursor, st.params_m[3], error);
+			}
+			else if (cursor.acceptWord("-normal")) {
+				glm::vec3 normal;
+				parsed = checkApplies(type == BINARY_PLANE, "-normal", st, error)
+					&& parseVector(cursor, normal, error);
+				if (parsed)
+					std::copy(&normal.x, &normal.x + 3, st.params_m);
+			}
+			else if (cursor.acceptWord("-intensity")) {
+				parsed = checkApplies(type == BINARY_LIGHT, "-intensity", st, error)
+					&& parseNumber(cursor, st.params_m[0], error);
+			}
+			else if (cursor.acceptWord("-source")) {
+				parsed = checkApplies(type == BINARY_MESH, "-source", st, error)
+					&& cursor.readName(st.source_m, st.sourceLength_m);
+				if (!parsed && error.empty())
+					error = "expected a mesh file";
+			}
+			else {
+				error = "expected an option or ';'";
+				parsed = false;
+			}
+			if (!parsed)
+				return false;
+		}
+		if (type == BINARY_MESH && st.sourceLength_m == 0) {
+			error = "a mesh needs a -source file";
+			return false;
+		}
+		return true;
+	}
+
+	ofColor toColor(const glm::vec3 &rgb)
+	{
+		glm::vec3 c = glm::clamp(rgb, 0.0f, 255.0f) + 0.5f;
+		return ofColor(static_cast<unsigned char>(c.x), static_cast<unsigned char>(c.y), static_cast<unsigned char>(c.z));
+	}
+
+	// Text scenes separate names with whitespace, ';', '<' and '>'
+	bool isTextName(const std::string &name)
+	{
+		if (name.empty())
+			return false;
+		for (char c : name) {
+			if (c == ';' || c == '<' || c == '>' || std::isspace(static_cast<unsigned char>(c)))
+				return false;
+		}
+		return true;
+	}
+
+	// Fills in rec like describe(), and false as well for objects whose
+	// name or mesh file could not be read back from a text scene
+	bool describeText(SceneObject *obj, SceneFile::BinaryRecord &rec)
+	{
+		return describe(obj, rec) && isTextName(obj->getName())
+			&& (rec.type_m != SceneFile::BINARY_MESH || isTextName(static_cast<Mesh *>(obj)->getSource()));
+	}
+
+	void writeStatement(TextWriter &out, SceneObject *obj, const SceneFile::BinaryRecord &rec, const std::unordered_set<const SceneObject *> &included)
+	{
+		using namespace SceneFile;
+		const float *p = rec.params_m;
+		out.text("create ", 7);
+		out.text(TYPE_KEYWORDS[rec.type_m]);
+		out.text(" ", 1);
+		out.text(obj->getName());
+		out.text(" -rotate ");
+		out.vector(obj->getLocalRotation());
+		out.text(" -translate ");
+		out.vector(obj->getLocalPosition());
+		// Anything at its default is left out, so plain joints read
+		// just as before
+		glm::vec3 scale = obj->getLocalScale();
+		if (scale != glm::vec3(1, 1, 1)) {
+			out.text(" -scale ");
+			out.vector(scale);
+		}
+		switch (rec.type_m)
+		{
+		case BINARY_SPHERE:
+			out.text(" -radius ");
+			out.number(p[0]);
+			break;
+		case BINARY_CONE:
+			out.text(" -radius ");
+			out.number(p[0]);
+			out.text(" -height ");
+			out.number(p[1]);
+			break;
+		case BINARY_PLANE:
+			out.text(" -normal ");
+			out.vector(glm::vec3(p[0], p[1], p[2]));
+			out.text(" -width ");
+			out.number(p[3]);
+			out.text(" -height ");
+			out.number(p[4]);
+			break;
+		case BINARY_LIGHT:
+			out.text(" -intensity ");
+			out.number(p[0]);
+			break;
+		case BINARY_MESH:
+			out.text(" -source ");
+			out.text(static_cast<Mesh *>(obj)->getSource());
+			break;
+		}
+		ofColor diffuse = obj->getDiffuse();
+		if (diffuse != defaultDiffuse(rec.type_m)) {
+			out.text(" -diffuse ");
+			out.color(diffuse);
+		}
+		ofColor specular = obj->getSpecular();
+		if (specular != ofColor::lightGray) {
+			out.text(" -specular ");
+			out.color(specular);
+		}
+		if (obj->isStatic() != (rec.type_m == BINARY_PLANE))
+			out.text(obj->isStatic() ? " -static 1" : " -static 0");
+		out.text(" -parent ");
+		SceneObject *parent = obj->getParent();
+		if (parent && included.count(parent))
+			out.text(parent->getName());
+		else
+			out.text("NULL", 4);
+		out.text(";\n", 2);
+	}
+}
+
+bool SceneFile::load(const std::string &path, std::vector<SceneObject *> &objs)
+{
+	return isBinaryPath(path) ? loadBinary(path, objs) : loadText(path, objs);
+}
+
+// One pass over the file held in memory. Statements that don't parse
+// are reported with their line and column and skipped, the rest of the
+// file still loads.
+bool SceneFile::loadText(const std::string &path, std::vector<SceneObject *> &objs)
+{
+	std::ifstream inF{ path, std::ios::binary | std::ios::ate };
+	if (!inF)
+		return false;
+	std::vector<char> text(static_cast<size_t>(inF.tellg()) + 1, '\0');
+	inF.seekg(0);
+	if (!inF.read(text.data(), text.size() - 1))
+		return false;
+
+	TextCursor cursor(text.data(), text.data() + text.size() - 1);
+	std::unordered_map<std::string, SceneObject *> names;
+	MeshCache meshes;
+	TextStatement st;
+	int errors = 0;
+	while (cursor.skipSpace()) {
+		int line = cursor.getLine();
+		std::string error;
+		if (!parseStatement(cursor, st, error)) {
+			std::cerr << path << ':' << cursor.getLine() << ':' << cursor.getColumn() << ": " << error << '\n';
+			// An error on a later line is most likely a missing ';',
+			// with the next statement starting where it stopped
+			if (cursor.getLine() == line)
+				cursor.skipLine();
+			errors++;
+			continue;
+		}
+
+		std::string name(st.name_m, st.nameLength_m);
+		SceneObject *obj = createObject(st.type_m, st.params_m, std::string(st.source_m, st.sourceLength_m),
+			st.translate_m, st.rotate_m, st.scale_m, meshes);
+		if (!obj) {
+			errors++;
+			continue;
+		}
+		obj->setName(name);
+		if (st.hasDiffuse_m)
+			obj->setDiffuse(toColor(st.diffuse_m));
+		if (st.hasSpecular_m)
+			obj->setSpecular(toColor(st.specular_m));
+		if (st.hasStatic_m)
+			obj->setStatic(st.static_m);
+		if (st.parentLength_m > 0) {
+			auto parent = names.find(std::string(st.parent_m, st.parentLength_m));
+			if (parent != names.end())
+				attachChild(parent->second, obj);
+			else
+				std::cerr << path << ':' << st.parentLine_m << ':' << st.parentColumn_m << ": parent "
+					<< std::string(st.parent_m, st.parentLength_m) << " is not defined before " << name << ", loaded without one\n";
+		}
+		// A later object of the same name is the one children attach to
+		names[name] = obj;
+		objs.push_back(obj);
+	}
+	if (errors > 0)
+		std::cerr << errors << " statements in " << path << " could not be read\n";
+	return true;
+}
+
+bool SceneFile::save(const std::string &path, const std::vector<SceneObject *> &objs)
+{
+	return isBinaryPath(path) ? saveBinary(path, objs) : saveText(path, objs);
+}
+
+// Objects are formatted into one reused buffer, so the time goes into
+// writing the file rather than building strings
+bool SceneFile::saveText(const std::string &path, const std::vector<SceneObject *> &objs)
+{
+	std::ofstream outF{ path, std::ios::binary | std::ios::trunc };
+	if (!outF)
+		return false;
+
+	// Only objects that are written can be named as parents
+	std::vector<SceneObject *> writable;
+	writable.reserve(objs.size());
+	BinaryRecord rec;
+	for (SceneObject *obj : objs) {
+		rec = {};
+		if (describeText(obj, rec))
+			writable.push_back(obj);
+	}
+	size_t skipped = objs.size() - writable.size();
+	std::unordered_set<const SceneObject *> included;
+	std::vector<SceneObject *> order = hierarchyOrder(writable, included);
+
+	{
+		TextWriter out(outF);
+		for (SceneObject *obj : order) {
+			rec = {};
+			describe(obj, rec);
+			writeStatement(out, obj, rec, included);
+		}
+	}
+	if (skipped > 0)
+		std::cerr << skipped << " objects without a text form or with names containing spaces, ';', '<' or '>' were left out of " << path << "\n";
+	outF.close();
+	return !outF.fail();
+}
+
+bool SceneFile::loadBinary(const std::string &path, std::vector<SceneObject *> &objs)
+{
+	BinaryView view;
+	if (!view.open(path))
+		return false;
+
+	uint32_t count = view.getObjectCount();
+	const BinaryRecord *records = view.getRecords();
+	std::vector<SceneObject *> loaded(count, NULL);
+	MeshCache meshes;
+	objs.reserve(objs.size() + count);
+	for (uint32_t i = 0; i < count; i++) {
+		const BinaryRecord &rec = records[i];
+		SceneObject *obj = createObject(rec.type_m, rec.params_m, view.getString(rec.source_m),
+			view.getPositions()[i], view.getRotations()[i], view.getScales()[i], meshes);
+		if (!obj)
+			continue;
+		obj->setName(view.getString(rec.name_m));
+		obj->setDiffuse(ofColor(rec.diffuse_m[0], rec.diffuse_m[1], rec.diffuse_m[2], rec.diffuse_m[3]));
+		obj->setSpecular(ofColor(rec.specular_m[0], rec.specular_m[1], rec.specular_m[2], rec.specular_m[3]));
+		obj->setStatic(rec.static_m != 0);
+		if (rec.parent_m >= 0 && loaded[rec.parent_m])
+			attachChild(loaded[rec.parent_m], obj);
+		loaded[i] = obj;
+		objs.push_back(obj);
+	}
+	return true;
+}
+
+bool SceneFile::saveBinary(const std::string &path, const std::vector<SceneObject *> &objs)
+{
+	std::unordered_set<const SceneObject *> included;
+	std::vector<SceneObject *> order = hierarchyOrder(objs, included);
+	std::unordered_map<const SceneObject *, int> index;
+	std::vector<glm::vec3> positions, rotations, scales;
+	std::vector<BinaryRecord> records;
+	std::string strings;
+	auto addString = [&strings](const std::string &str) {
+		uint32_t offset = static_cast<uint32_t>(strings.size());
+		strings.append(str.c_str(), str.size() + 1);
+		return offset;
+	};
+
+	int skipped = 0;
+	for (SceneObject *obj : order) {
+		BinaryRecord rec = {};
+		if (!describe(obj, rec)) {
+			skipped++;
+			continue;
+		}
+		auto parent = index.find(obj->getParent());
+		rec.parent_m = parent == index.end() ? -1 : parent->second;
+		rec.static_m = obj->isStatic();
+		rec.name_m = addString(obj->getName());
+		rec.source_m = addString(rec.type_m == BINARY_MESH ? static_cast<Mesh *>(obj)->getSource() : "");
+		ofColor diffuse = obj->getDiffuse();
+		ofColor specular = obj->getSpecular();
+		const unsigned char colors[8] = { diffuse.r, diffuse.g, diffuse.b, diffuse.a, specular.r, specular.g, specular.b, specular.a };
+		std::memcpy(rec.diffuse_m, colors, 4);
+		std::memcpy(rec.specular_m, colors + 4, 4);
+
+		index[obj] = static_cast<int>(records.size());
+		records.push_back(rec);
+		positions.push_back(obj->getLocalPosition());
+		rotations.push_back(obj->getLocalRotation());
+		scales.push_back(obj->getLocalScale());
+	}
+	if (skipped > 0)
+		std::cerr << skipped << " objects of types the binary format has no record for were left out of " << path << "\n";
+
+	size_t count = records.size();
+	BinaryHeader header = {};
+	std::memcpy(header.magic_m, "SOB", 4);
+	header.version_m = BINARY_VERSION;
+	header.byteOrder_m = BYTE_ORDER_MARK;
+	header.objectCount_m = static_cast<uint32_t>(count);
+	header.stringBytes_m = strings.size();
+	header.positionsOffset_m = alignSection(sizeof(BinaryHeader));
+	header.rotationsOffset_m = alignSection(header.positionsOffset_m + count * sizeof(glm::vec3));
+	header.scalesOffset_m = alignSection(header.rotationsOffset_m + count * sizeof(glm::vec3));
+	header.recordsOffset_m = alignSection(header.scalesOffset_m + count * sizeof(glm::vec3));
+	header.stringsOffset_m = alignSection(header.recordsOffset_m + count * sizeof(BinaryRecord));
+
+	std::ofstream outF{ path, std::ios::binary | std::ios::trunc };
+	if (!outF)
+		return false;
+	uint64_t written = 0;
+	writeSection(outF, written, 0, &header, sizeof(header));
+	writeSection(outF, written, header.positionsOffset_m, positions.data(), count * sizeof(glm::vec3));
+	writeSection(outF, written, header.rotationsOffset_m, rotations.data(), count * sizeof(glm::vec3));
+	writeSection(outF, written, header.scalesOffset_m, scales.data(), count * sizeof(glm::vec3));
+	writeSection(outF, written, header.recordsOffset_m, records.data(), count * sizeof(BinaryRecord));
+	writeSection(outF, written, header.stringsOffset_m, strings.data(), strings.size());
+	outF.close();
+	return !outF.fail();
+}
+
+bool SceneFile::loadObj(const std::string &path, ofMesh &mesh)
+{
+	std::ifstream file(path);
+	if (!file)
+		return false;
+	std::string line;
+	while (std::getline(file, line)) {
+		std::stringstream data(line);
+		std::string type;
+		data >> type;
+		if (type == "v") {
+			glm::vec3 v;
+			data >> v.x >> v.y >> v.z;
+			mesh.addVertex(v);
+		}
+		else if (type == "f") {
+			// "i", "i/t" or "i/t/n", fanned into triangles
+			std::vector<unsigned int> face;
+			std::string vertex;
+			while (data >> vertex)
+				face.push_back(std::stoi(vertex) - 1);
+			for (int i = 2; i < face.size(); i++) {
+				mesh.addIndex(face[0]);
+				mesh.addIndex(face[i - 1]);
+				mesh.addIndex(face[i]);
+			}
+		}
+	}
+	return true;
+}
+
+// BinaryView Functions
+//
+bool SceneFile::BinaryView::open(const std::string &path)
+{
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	HANDLE mapping = NULL;
+	const void *data = NULL;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping)
+			data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+	if (!data) {
+		if (mapping)
+			CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	file_m = file;
+	mapping_m = mapping;
+	size_m = static_cast<size_t>(size.QuadPart);
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	void *data = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size > 0)
+		data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping stays valid without the descriptor
+	::close(fd);
+	if (data == MAP_FAILED)
+		return false;
+	size_m = static_cast<size_t>(info.st_size);
+#endif
+	data_m = static_cast<const unsigned char *>(data);
+	header_m = reinterpret_cast<const BinaryHeader *>(data_m);
+	if (!validate()) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void SceneFile::BinaryView::close()
+{
+	if (!data_m)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(data_m);
+	CloseHandle(mapping_m);
+	CloseHandle(file_m);
+	file_m = mapping_m = nullptr;
+#else
+	munmap(const_cast<unsigned char *>(data_m), size_m);
+#endif
+	data_m = nullptr;
+	header_m = nullptr;
+	size_m = 0;
+}
+
+// Every offset the accessors and the loader follow must stay inside
+// the file, so a truncated or corrupt file is rejected here
+bool SceneFile::BinaryView::validate() const
+{
+	if (size_m < sizeof(BinaryHeader) || std::memcmp(header_m->magic_m, "SOB", 4) != 0)
+		return false;
+	const BinaryHeader &h = *header_m;
+	if (h.version_m != BINARY_VERSION || h.byteOrder_m != BYTE_ORDER_MARK) {
+		std::cerr << "Binary scene version " << h.version_m << " can't be read, this build reads version " << BINARY_VERSION << " in its own byte order\n";
+		return false;
+	}
+
+	uint64_t count = h.objectCount_m;
+	auto fits = [this](uint64_t offset, uint64_t bytes) { return offset % 16 == 0 && offset <= size_m && bytes <= size_m - offset; };
+	if (!fits(h.positionsOffset_m, count * sizeof(glm::vec3)) || !fits(h.rotationsOffset_m, count * sizeof(glm::vec3))
+		|| !fits(h.scalesOffset_m, count * sizeof(glm::vec3)) || !fits(h.recordsOffset_m, count * sizeof(BinaryRecord))
+		|| !fits(h.stringsOffset_m, h.stringBytes_m) || h.stringBytes_m > UINT32_MAX)
+		return false;
+	// With the last string terminated, every offset below stringBytes reads a terminated string
+	if (count > 0 && (h.stringBytes_m == 0 || getString(0)[h.stringBytes_m - 1] != '\0'))
+		return false;
+
+	const BinaryRecord *records = getRecords();
+	for (uint64_t i = 0; i < count; i++) {
+		const BinaryRecord &rec = records[i];
+		if (rec.type_m > BINARY_LIGHT || rec.parent_m < -1 || rec.parent_m >= static_cast<int64_t>(i)
+			|| rec.name_m >= h.stringBytes_m || rec.source_m >= h.stringBytes_m)
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,124 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "SceneObject.h"
+
+// Reading and writing of .so scene files, independent of ofApp
+// so that scenes can also be loaded without a window.
+//
+// Scenes come in two formats holding the same objects: every type
+// with its hierarchy, colors, lights and mesh file references. The .so
+// text format is readable and editable; the .sob binary format is read
+// straight from a memory mapped file.
+namespace SceneFile
+{
+	// Append every object in the file at path to objs, parents
+	// before their children. Files ending in .sob are read as binary.
+	// Returns false if the file could not be opened or read.
+	bool load(const std::string &path, std::vector<SceneObject *> &objs);
+	// Write objs to path, as binary if it ends in .sob and as text
+	// otherwise. Returns false if the file could not be written.
+	bool save(const std::string &path, const std::vector<SceneObject *> &objs);
+	// Write objs as text, one create statement per object, parents
+	// first. Options at their defaults are left out. Objects the text
+	// can't name, and meshes without a source file, are skipped with a
+	// warning. Returns false if the file could not be written.
+	bool saveText(const std::string &path, const std::vector<SceneObject *> &objs);
+	// Statements that can't be read are reported as path:line:column
+	// and skipped. Parents must be defined before their children.
+	bool loadText(const std::string &path, std::vector<SceneObject *> &objs);
+
+	bool loadBinary(const std::string &path, std::vector<SceneObject *> &objs);
+	// Objects whose parent is not in objs are saved as roots, with
+	// their local transform. Meshes without a source file are skipped.
+	bool saveBinary(const std::string &path, const std::vector<SceneObject *> &objs);
+
+	// Vertices and faces of a Wavefront .obj file, faces fanned
+	// into triangles. Returns false if the file could not be opened.
+	bool loadObj(const std::string &path, ofMesh &mesh);
+
+	// Binary layout, native byte order:
+	//
+	//   BinaryHeader
+	//   positions   objectCount x 3 floats   local, like the text format
+	//   rotations   objectCount x 3 floats   euler degrees
+	//   scales      objectCount x 3 floats
+	//   records     objectCount x BinaryRecord
+	//   strings     stringBytes, null terminated names and file paths
+	//
+	// Sections start on 16 byte boundaries. Every record's parent comes
+	// before it, so a scene is built in one pass.
+	const uint32_t BINARY_VERSION{ 1 };
+
+	enum BinaryType : uint8_t { BINARY_JOINT, BINARY_SPHERE, BINARY_CONE, BINARY_PLANE, BINARY_MESH, BINARY_LIGHT };
+
+	struct BinaryHeader
+	{
+		char magic_m[4];		// "SOB" and a zero
+		uint32_t version_m;
+		uint32_t byteOrder_m;	// 0x01020304 as written
+		uint32_t objectCount_m;
+		uint64_t stringBytes_m;
+		uint64_t positionsOffset_m;
+		uint64_t rotationsOffset_m;
+		uint64_t scalesOffset_m;
+		uint64_t recordsOffset_m;
+		uint64_t stringsOffset_m;
+	};
+
+	struct BinaryRecord
+	{
+		uint8_t type_m;
+		uint8_t static_m;
+		uint16_t reserved_m;
+		int32_t parent_m;		// index of an earlier record, or -1
+		uint32_t name_m;		// offset into the strings
+		uint32_t source_m;		// mesh file, offset into the strings
+		uint8_t diffuse_m[4];
+		uint8_t specular_m[4];
+		// Sphere: radius. Cone: radius, height. Plane: normal,
+		// draw width and height. Light: intensity.
+		float params_m[6];
+	};
+
+	// Read only view of a binary scene file mapped into memory. The
+	// arrays point into the file and stay valid until close().
+	class BinaryView
+	{
+	private:
+		const unsigned char *data_m = nullptr;
+		size_t size_m = 0;
+		const BinaryHeader *header_m = nullptr;
+#ifdef _WIN32
+		void *file_m = nullptr;
+		void *mapping_m = nullptr;
+#endif
+
+	public:
+		BinaryView() {}
+		BinaryView(const BinaryView &) = delete;
+		BinaryView& operator=(const BinaryView &) = delete;
+		~BinaryView() { close(); }
+
+		// False if the file is missing, is not a binary scene or was
+		// written by a version or on a byte order this build can't read
+		bool open(const std::string &path);
+		void close();
+
+		uint32_t getObjectCount() const { return header_m->objectCount_m; }
+		const glm::vec3* getPositions() const { return reinterpret_cast<const glm::vec3 *>(data_m + header_m->positionsOffset_m); }
+		const glm::vec3* getRotations() const { return reinterpret_cast<const glm::vec3 *>(data_m + header_m->rotationsOffset_m); }
+		const glm::vec3* getScales() const { return reinterpret_cast<const glm::vec3 *>(data_m + header_m->scalesOffset_m); }
+		const BinaryRecord* getRecords() const { return reinterpret_cast<const BinaryRecord *>(data_m + header_m->recordsOffset_m); }
+		const char* getString(uint32_t offset) const { return reinterpret_cast<const char *>(data_m + header_m->stringsOffset_m + offset); }
+
+	private:
+		bool validate() const;
+	};
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "SceneObject.h"
+#include "RenderStats.h"
 
 // SceneObject Functions
 //
@@ -18,8 +19,11 @@ glm::mat4 SceneObject::getScaleMatrix() const
 	return (glm::scale(glm::mat4(1.0), glm::vec3(scale_m.x, scale_m.y, scale_m.z)));
 }
 
-glm::mat4 SceneObject::getLocalMatrix() const
+const glm::mat4& SceneObject::getLocalMatrix() const
 {
+	if (!localDirty_m)
+		return localMatrix_m;
+
 	// get the local transformations + pivot
 	//
 	glm::mat4 scale = getScaleMatrix();
@@ -31,19 +35,92 @@ glm::mat4 SceneObject::getLocalMatrix() const
 	glm::mat4 pre = glm::translate(glm::mat4(1.0), glm::vec3(-pivotPoint_m.x, -pivotPoint_m.y, -pivotPoint_m.z));
 	glm::mat4 post = glm::translate(glm::mat4(1.0), glm::vec3(pivotPoint_m.x, pivotPoint_m.y, pivotPoint_m.z));
 
-	return (trans * post * rotate * pre * scale);
+	localMatrix_m = trans * post * rotate * pre * scale;
+	localDirty_m = false;
+	return localMatrix_m;
 }
 
-glm::mat4 SceneObject::getMatrix() const
+const glm::mat4& SceneObject::getMatrix() const
 {
+	if (!worldDirty_m)
+		return worldMatrix_m;
+
 	// if we have a parent (we are not the root),
 	// concatenate parent's transform (this is recursive)
 	// 
-	if (parent_m) {
-		glm::mat4 M = parent_m->getMatrix();
-		return (M * getLocalMatrix());
+	if (parent_m)
+		worldMatrix_m = parent_m->getMatrix() * getLocalMatrix();
+	else
+		worldMatrix_m = getLocalMatrix();  // priority order is SRT
+	worldDirty_m = false;
+	return worldMatrix_m;
+}
+
+const glm::mat4& SceneObject::getInverseMatrix() const
+{
+	const glm::mat4 &m = getMatrix();
+	if (inverseDirty_m) {
+		RENDER_STATS_ADD(MATRIX_INVERSIONS, 1);
+		inverseMatrix_m = glm::inverse(m);
+		inverseDirty_m = false;
 	}
-	else return getLocalMatrix();  // priority order is SRT
+	return inverseMatrix_m;
+}
+
+AABB SceneObject::getWorldBounds() const
+{
+	AABB bounds = getLocalBounds();
+	return bounds.valid() ? bounds.transformed(getMatrix()) : bounds;
+}
+
+// Bring an object space hit back to world space. Normals go through
+// the inverse transpose so non-uniform scale keeps them perpendicular.
+void SceneObject::objectToWorld(glm::vec3 &point, glm::vec3 &normal) const
+{
+	point = getMatrix() * glm::vec4(point, 1.0);
+	normal = glm::normalize(glm::transpose(glm::mat3(getInverseMatrix())) * normal);
+}
+
+// Ray in object space with a unit direction. tScale converts a
+// distance along the world ray into one along the object ray.
+Ray SceneObject::worldToObject(const Ray &ray, float &tScale) const
+{
+	const glm::mat4 &mInv = getInverseMatrix();
+	glm::vec3 p = mInv * glm::vec4(ray.getPosition(), 1.0);
+	glm::vec3 d = mInv * glm::vec4(ray.getDirection(), 0.0);
+	tScale = glm::length(d);
+	return Ray(p, d / tScale);
+}
+
+// Fallback for objects without a cheaper test
+bool SceneObject::occluded(const Ray &ray, float tMax)
+{
+	RENDER_STATS_ADD(OCCLUDED_TESTS, 1);
+	glm::vec3 point, normal;
+	return intersect(ray, point, normal) && !(glm::length(point - ray.getPosition()) > tMax);
+}
+
+void SceneObject::updateMatrices() const
+{
+	getInverseMatrix();
+}
+
+void SceneObject::markLocalDirty()
+{
+	localDirty_m = true;
+	markWorldDirty();
+}
+
+// A clean world matrix implies a clean parent, so once we reach an
+// object that is already dirty its whole subtree is dirty too.
+void SceneObject::markWorldDirty()
+{
+	if (worldDirty_m)
+		return;
+	worldDirty_m = true;
+	inverseDirty_m = true;
+	for (SceneObject *child : childList_m)
+		child->markWorldDirty();
 }
 
 // Generate a rotation matrix that rotates v1 to v2
@@ -59,9 +136,10 @@ glm::mat4 SceneObject::rotateToVector(glm::vec3 v1, glm::vec3 v2) const
 // Set position (pos is in world space)
 void SceneObject::setWorldPosition(glm::vec3 pos) {
 	if (parent_m)
-		position_m = glm::inverse(parent_m->getMatrix()) * glm::vec4(pos, 1.0);
+		position_m = parent_m->getInverseMatrix() * glm::vec4(pos, 1.0);
 	else
 		position_m = pos;
+	markLocalDirty();
 }
 
 // Hierarchy 
@@ -69,6 +147,28 @@ void SceneObject::addChild(SceneObject *child)
 {
 	childList_m.push_back(child);
 	child->parent_m = this;
+	child->markWorldDirty();
+}
+
+void SceneObject::relink(const std::unordered_map<const SceneObject *, SceneObject *> &clones)
+{
+	auto find = [&clones](const SceneObject *obj) -> SceneObject * {
+		auto it = clones.find(obj);
+		return it == clones.end() ? NULL : it->second;
+	};
+
+	parent_m = find(parent_m);
+	std::vector<SceneObject *> children;
+	for (SceneObject *child : childList_m) {
+		if (SceneObject *clone = find(child))
+			children.push_back(clone);
+	}
+	childList_m = children;
+
+	// The parent may have changed. Every clone gets relinked, so
+	// marking each one dirty directly keeps the parent-first invariant.
+	worldDirty_m = true;
+	inverseDirty_m = true;
 }
 
 // Fix object's rotation vector so that object's z axis aligns with pos
@@ -79,6 +179,7 @@ void SceneObject::fixRotationWith(const glm::vec3 pos)
 	rotation_m.x = glm::degrees(-atan2f(distVector.y, xzdis));
 	rotation_m.y = glm::degrees(-atan2f(-distVector.x, distVector.z));
 	rotation_m.z = 0;
+	markLocalDirty();
 }
 
 // SceneObject Destructor
@@ -108,19 +209,40 @@ SceneObject::~SceneObject()
 //
 bool Light::intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal)
 {
+	RENDER_STATS_ADD(INTERSECT_LIGHT, 1);
 	// transform Ray to object space.  
 	//
-	glm::mat4 mInv = glm::inverse(getMatrix());
+	const glm::mat4 &mInv = getInverseMatrix();
 	glm::vec4 p = mInv * glm::vec4(ray.getPosition().x, ray.getPosition().y, ray.getPosition().z, 1.0);
 	glm::vec4 p1 = mInv * glm::vec4(ray.getPosition() + ray.getDirection(), 1.0);
 	glm::vec3 d = glm::normalize(p1 - p);
-	return (glm::intersectRaySphere(glm::vec3(p), d, glm::vec3(0, 0, 0), 0.1, point, normal));
+	if (!glm::intersectRaySphere(glm::vec3(p), d, glm::vec3(0, 0, 0), 0.1, point, normal))
+		return false;
+	objectToWorld(point, normal);
+	return true;
+}
+
+bool Light::occluded(const Ray &ray, float tMax)
+{
+	RENDER_STATS_ADD(OCCLUDED_TESTS, 1);
+	float tScale, dist;
+	Ray r = worldToObject(ray, tScale);
+	return glm::intersectRaySphere(r.getPosition(), r.getDirection(), glm::vec3(0, 0, 0), 0.1f * 0.1f, dist) && !(dist > tMax * tScale);
+}
+
+AABB Light::getLocalBounds() const
+{
+	AABB bounds;
+	bounds.grow(glm::vec3(-0.1));
+	bounds.grow(glm::vec3(0.1));
+	return bounds;
 }
 
 // Plane Functions
 //
 bool Plane::intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal)
 {
+	RENDER_STATS_ADD(INTERSECT_PLANE, 1);
 	float dist;
 	bool hit = glm::intersectRayPlane(ray.getPosition(), ray.getDirection(), getWorldPosition(), normal_m, dist);
 	if (hit) {
@@ -130,6 +252,13 @@ bool Plane::intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal)
 	return hit;
 }
 
+bool Plane::occluded(const Ray &ray, float tMax)
+{
+	RENDER_STATS_ADD(OCCLUDED_TESTS, 1);
+	float dist;
+	return glm::intersectRayPlane(ray.getPosition(), ray.getDirection(), getWorldPosition(), normal_m, dist) && !(dist > tMax);
+}
+
 float Plane::sdf(const glm::vec3 &p) {
 	return p.y - getWorldPosition().y;
 }
@@ -160,6 +289,12 @@ Ray RenderCam::getRay(float u, float v)
 	return(Ray(getWorldPosition(), glm::normalize(pointOnPlane - getWorldPosition())));
 }
 
+void RenderCam::updateMatrices() const
+{
+	SceneObject::updateMatrices();
+	view.updateMatrices();
+}
+
 void RenderCam::draw()
 {
 	ofDrawBox(getWorldPosition(), 1.0);
@@ -170,13 +305,33 @@ void RenderCam::draw()
 //
 bool Sphere::intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal)
 {
+	RENDER_STATS_ADD(INTERSECT_SPHERE, 1);
 	// transform Ray to object space.  
-	glm::mat4 mInv = glm::inverse(getMatrix());
+	const glm::mat4 &mInv = getInverseMatrix();
 	glm::vec4 p = mInv * glm::vec4(ray.getPosition().x, ray.getPosition().y, ray.getPosition().z, 1.0);
 	glm::vec4 p1 = mInv * glm::vec4(ray.getPosition() + ray.getDirection(), 1.0);
 	glm::vec3 d = glm::normalize(p1 - p);
 	
-	return (glm::intersectRaySphere(glm::vec3(p), d, glm::vec3(0, 0, 0), radius_m, point, normal));
+	if (!glm::intersectRaySphere(glm::vec3(p), d, glm::vec3(0, 0, 0), radius_m, point, normal))
+		return false;
+	objectToWorld(point, normal);
+	return true;
+}
+
+bool Sphere::occluded(const Ray &ray, float tMax)
+{
+	RENDER_STATS_ADD(OCCLUDED_TESTS, 1);
+	float tScale, dist;
+	Ray r = worldToObject(ray, tScale);
+	return glm::intersectRaySphere(r.getPosition(), r.getDirection(), glm::vec3(0, 0, 0), radius_m * radius_m, dist) && !(dist > tMax * tScale);
+}
+
+AABB Sphere::getLocalBounds() const
+{
+	AABB bounds;
+	bounds.grow(glm::vec3(-radius_m));
+	bounds.grow(glm::vec3(radius_m));
+	return bounds;
 }
 
 float Sphere::sdf(const glm::vec3 &p)
@@ -184,6 +339,16 @@ float Sphere::sdf(const glm::vec3 &p)
 	return glm::length(p - getWorldPosition()) - radius_m;
 }
 
+bool Sphere::sdfGradient(const glm::vec3 &p, glm::vec3 &gradient) const
+{
+	glm::vec3 d = p - getWorldPosition();
+	float len = glm::length(d);
+	if (len == 0)
+		return false;
+	gradient = d / len;
+	return true;
+}
+
 void Sphere::draw() {
 	// get the current transformation matrix for this object
 	glm::mat4 m = getMatrix();
@@ -200,11 +365,12 @@ void Sphere::draw() {
 //
 bool Cone::intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal)
 {
+	RENDER_STATS_ADD(INTERSECT_CONE, 1);
 	bool hit = false;
 
 	// transform Ray to object space.  
 	//
-	glm::mat4 mInv = glm::inverse(getMatrix());
+	const glm::mat4 &mInv = getInverseMatrix();
 	glm::vec4 p = mInv * glm::vec4(ray.getPosition().x, ray.getPosition().y, ray.getPosition().z, 1.0);
 	glm::vec4 p1 = mInv * glm::vec4(ray.getPosition() + ray.getDirection(), 1.0);
 	glm::vec3 d = glm::normalize(p1 - p);
@@ -276,9 +442,19 @@ bool Cone::intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal)
 		}
 	}
 
+	if (hit)
+		objectToWorld(point, normal);
 	return hit;
 }
 
+AABB Cone::getLocalBounds() const
+{
+	AABB bounds;
+	bounds.grow(glm::vec3(-radius_m, -radius_m, -height_m / 2));
+	bounds.grow(glm::vec3(radius_m, radius_m, height_m / 2));
+	return bounds;
+}
+
 void Cone::draw() {
 	glm::mat4 m = getMatrix();
 
@@ -291,38 +467,93 @@ void Cone::draw() {
 
 // Mesh Functions
 //
+void Mesh::buildGeometry(const ofMesh &mesh)
+{
+	std::shared_ptr<Geometry> geometry = std::make_shared<Geometry>();
+	geometry->mesh_m = mesh;
+	geometry->tris_m.build(mesh);
+	std::vector<AABB> triBounds(geometry->tris_m.size());
+	for (int i = 0; i < geometry->tris_m.size(); i++)
+		triBounds[i] = geometry->tris_m.getBounds(i);
+	geometry->bvh_m.build(triBounds);
+	geometry_m = geometry;
+}
+
+size_t Mesh::getGeometryMemoryUsage() const
+{
+	const ofMesh &mesh = geometry_m->mesh_m;
+	return (mesh.getNumVertices() + mesh.getNumNormals()) * sizeof(glm::vec3)
+		+ mesh.getNumIndices() * sizeof(ofIndexType)
+		+ geometry_m->tris_m.getMemoryUsage()
+		+ geometry_m->bvh_m.getMemoryUsage();
+}
+
 bool Mesh::intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal)
 {
-	glm::mat4 mInv = glm::inverse(getMatrix());
+	RENDER_STATS_ADD(INTERSECT_MESH, 1);
+	const glm::mat4 &mInv = getInverseMatrix();
 	glm::vec4 p = mInv * glm::vec4(ray.getPosition().x, ray.getPosition().y, ray.getPosition().z, 1.0);
 	glm::vec4 p1 = mInv * glm::vec4(ray.getPosition() + ray.getDirection(), 1.0);
 	glm::vec3 d = glm::normalize(p1 - p);
 
-	int j = 0;
-	bool hit = false;
+	const TriangleBuffer &tris = geometry_m->tris_m;
+	glm::vec3 orig = glm::vec3(p);
 	float nearestDist = FLT_MAX;
-	glm::vec2 bary;
-	for (ofMeshFace tri : mesh_m.getUniqueFaces())
-	{
+	int nearestTri = -1;
+	int triTests = 0;
+	geometry_m->bvh_m.traverse(orig, d, nearestDist, [&](int i, float &tMax) {
 		float dist;
-		if (glm::intersectRayTriangle(glm::vec3(p), d, tri.getVertex(0), tri.getVertex(1), tri.getVertex(2), bary, dist) &&  dist < nearestDist)
+		triTests++;
+		if (tris.intersect(i, orig, d, dist) && dist < tMax)
 		{
-			nearestDist = dist;
-			hit = true;
-			normal = tri.getFaceNormal();
-			point = glm::vec3(p) + d * nearestDist;
+			tMax = dist;
+			nearestTri = i;
+			return true;
 		}
-	}
+		return false;
+	});
+	RENDER_STATS_ADD(TRIANGLE_TESTS, triTests);
+
+	if (nearestTri < 0)
+		return false;
+	normal = tris.getNormal(nearestTri);
+	point = orig + d * nearestDist;
+	objectToWorld(point, normal);
+	return true;
+}
+
+bool Mesh::occluded(const Ray &ray, float tMax)
+{
+	RENDER_STATS_ADD(OCCLUDED_TESTS, 1);
+	float tScale;
+	Ray r = worldToObject(ray, tScale);
+	glm::vec3 orig = r.getPosition();
+	glm::vec3 d = r.getDirection();
+	float objMax = tMax * tScale;
+	const TriangleBuffer &tris = geometry_m->tris_m;
+	int triTests = 0;
+	bool hit = geometry_m->bvh_m.traverseAny(orig, d, objMax, [&](int i) {
+		float dist;
+		triTests++;
+		return tris.intersect(i, orig, d, dist) && !(dist > objMax);
+	});
+	RENDER_STATS_ADD(TRIANGLE_TESTS, triTests);
 	return hit;
 }
 
+AABB Mesh::getLocalBounds() const
+{
+	const BVH &bvh = geometry_m->bvh_m;
+	return bvh.empty() ? AABB() : bvh.getNodes()[0].bounds_m;
+}
+
 void Mesh::draw()
 {
 	glm::mat4 m = getMatrix();
 
 	ofPushMatrix();
 	ofMultMatrix(m);
-	mesh_m.drawWireframe();
+	geometry_m->mesh_m.drawWireframe();
 	ofPopMatrix();
 }
 
@@ -365,9 +596,16 @@ void Joint::addChild(SceneObject *child) {
 		jointChild->adjustConnector();
 }
 
+void Joint::updateMatrices() const
+{
+	SceneObject::updateMatrices();
+	node_m.updateMatrices();
+	conn_m.updateMatrices();
+}
+
 void Joint::adjustConnector()
 {
-	glm::vec3 connPos = glm::inverse(getMatrix()) * glm::vec4(getMidPoint(parent_m->getWorldPosition()), 1.0);
+	glm::vec3 connPos = getInverseMatrix() * glm::vec4(getMidPoint(parent_m->getWorldPosition()), 1.0);
 	conn_m.setWorldPosition(connPos);
 	conn_m.fixRotationWith(glm::vec3(0, 0, 0));
 	conn_m.setHeight(glm::length(getLocalPosition()) - 0.6);
@@ -375,7 +613,8 @@ void Joint::adjustConnector()
 
 bool Joint::intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal)
 {
-	glm::mat4 mInv = glm::inverse(getMatrix());
+	RENDER_STATS_ADD(INTERSECT_JOINT, 1);
+	const glm::mat4 &mInv = getInverseMatrix();
 	glm::vec4 p = mInv * glm::vec4(ray.getPosition().x, ray.getPosition().y, ray.getPosition().z, 1.0);
 	glm::vec4 p1 = mInv * glm::vec4(ray.getPosition() + ray.getDirection(), 1.0);
 	glm::vec3 d = glm::normalize(p1 - p);
@@ -403,13 +642,11 @@ bool Joint::intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal)
 		{
 			point = nodePoint;
 			normal = nodeNormal;
-			return true;
 		}
 		else if (connHit)
 		{
 			point = connPoint;
 			normal = connNormal;
-			return true;
 		}
 	}
 	else
@@ -417,7 +654,27 @@ bool Joint::intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal)
 		point = nodePoint;
 		normal = nodeNormal;
 	}
-	return nodeHit;
+
+	// node_m and conn_m answer in joint space
+	if (nodeHit || connHit)
+		objectToWorld(point, normal);
+	return nodeHit || connHit;
+}
+
+bool Joint::occluded(const Ray &ray, float tMax)
+{
+	RENDER_STATS_ADD(OCCLUDED_TESTS, 1);
+	float tScale;
+	Ray r = worldToObject(ray, tScale);
+	return node_m.occluded(r, tMax * tScale) || (parent_m && conn_m.occluded(r, tMax * tScale));
+}
+
+AABB Joint::getLocalBounds() const
+{
+	AABB bounds = node_m.getLocalBounds();
+	if (parent_m)
+		bounds.grow(conn_m.getLocalBounds().transformed(conn_m.getMatrix()));
+	return bounds;
 }
 
 void Joint::draw()
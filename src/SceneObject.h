@@ -4,10 +4,13 @@
 #include <glm/gtx/intersect.hpp>
 #include <glm/gtx/euler_angles.hpp>
 #include <iostream>
+#include <unordered_map>
 
 #include "ofMain.h"
 #include "ofxAssimpModelLoader.h"
+#include "BVH.h"
 #include "Ray.h"
+#include "TriangleBuffer.h"
 
 // SceneObject Matrix + Hierarchy Functions 
 // & SceneObject Member Variables credits to
@@ -23,9 +26,21 @@ private:
 	ofColor specularColor_m;					// Default color:		light gray
 	std::string name_h = "SceneObject";
 
+	// Cached transforms. The local matrix is rebuilt when position,
+	// rotation or scale change. The world and inverse world matrices
+	// are rebuilt when this object or any ancestor changes.
+	mutable glm::mat4 localMatrix_m;
+	mutable glm::mat4 worldMatrix_m;
+	mutable glm::mat4 inverseMatrix_m;
+	mutable bool localDirty_m = true;
+	mutable bool worldDirty_m = true;
+	mutable bool inverseDirty_m = true;
+
 protected:
 	bool isSelectable_m = true;
 	bool hasSDF_m = false;
+	// Never moves, so its SDF may be baked by the Renderer
+	bool isStatic_m = false;
 
 	SceneObject *parent_m = NULL;
 	std::vector<SceneObject *> childList_m;
@@ -49,35 +64,83 @@ public:
 	glm::mat4 getRotateMatrix() const;
 	glm::mat4 getTranslateMatrix() const;
 	glm::mat4 getScaleMatrix() const;
-	glm::mat4 getLocalMatrix() const;
-	glm::mat4 getMatrix() const;
+	const glm::mat4& getLocalMatrix() const;
+	const glm::mat4& getMatrix() const;
+	const glm::mat4& getInverseMatrix() const;
 	glm::mat4 rotateToVector(glm::vec3 v1, glm::vec3 v2) const;
 
 	glm::vec3 getWorldPosition() const { return (getMatrix() * glm::vec4(0.0, 0.0, 0.0, 1.0)); }
 	glm::vec3 getLocalPosition() const { return position_m; }
 	glm::vec3 getLocalRotation() { return rotation_m; }
-	std::string getName() const { return name_h; }
+	glm::vec3 getLocalScale() const { return scale_m; }
+	const std::string& getName() const { return name_h; }
 	ofColor getDiffuse() const { return diffuseColor_m; }
 	ofColor getSpecular() const { return specularColor_m; }
 	std::string getParentName() const { return (parent_m ? parent_m->getName() : "NULL"); }
+	SceneObject* getParent() const { return parent_m; }
 	std::vector<SceneObject *> getChildList() const { return childList_m; }
+	const std::vector<SceneObject *>& getChildren() const { return childList_m; }
 	bool hasParent() const { return parent_m; }
 	bool selectable() const { return isSelectable_m; }
 	bool hasSDF() const { return hasSDF_m; }
+	bool isStatic() const { return isStatic_m; }
+	void setStatic(bool isStatic) { isStatic_m = isStatic; }
 
 	virtual void setWorldPosition(glm::vec3 pos);
-	virtual void setLocalPosition(glm::vec3 pos) { position_m = pos; }
-	virtual void setLocalRotation(glm::vec3 rot) { rotation_m = rot; }
+	virtual void setLocalPosition(glm::vec3 pos) { position_m = pos; markLocalDirty(); }
+	virtual void setLocalRotation(glm::vec3 rot) { rotation_m = rot; markLocalDirty(); }
+	void setLocalScale(glm::vec3 sca) { scale_m = sca; markLocalDirty(); }
+	// Position and rotation at once, marking the matrices dirty once.
+	// Subclasses are not told, so a Joint's connector has to be fitted
+	// with adjustConnector() afterward.
+	void setLocalTransform(glm::vec3 pos, glm::vec3 rot) { position_m = pos; rotation_m = rot; markLocalDirty(); }
+	void setDiffuse(ofColor diffuse) { diffuseColor_m = diffuse; }
+	void setSpecular(ofColor specular) { specularColor_m = specular; }
 	virtual void setName(std::string name) { name_h = name; }
 
 	virtual void addChild(SceneObject *child);
 	virtual void fixRotationWith(const glm::vec3 pos);
 
+	// Fill the matrix caches up front. The getters above fill them
+	// lazily, which is not safe once several render threads read the
+	// same object, so the Renderer calls this before tracing.
+	virtual void updateMatrices() const;
+
+	// point and normal are returned in world space
 	virtual bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) { cout << "SceneObject::intersect\n"; return false; }
+
+	// Any-hit query for shadow rays: is the object hit no farther
+	// than tMax along ray (direction normalized)? Stops at the first
+	// hit found and skips hit point / normal work where it can.
+	virtual bool occluded(const Ray &ray, float tMax);
+
+	// Object space bounds. An invalid (empty) box means the object is
+	// unbounded, like the infinite ground Plane.
+	virtual AABB getLocalBounds() const { return AABB(); }
+	AABB getWorldBounds() const;
 	virtual float sdf(const glm::vec3 &p) { return FLT_MAX; }
+	// World space sphere that sdf() never undercuts:
+	// sdf(p) >= length(p - center) - radius. False if there is none.
+	virtual bool getSDFBounds(glm::vec3 &center, float &radius) const { return false; }
+	// Unit gradient of sdf() at p, for objects that can give it
+	// exactly. False if the Renderer has to estimate it.
+	virtual bool sdfGradient(const glm::vec3 &p, glm::vec3 &gradient) const { return false; }
 	virtual void draw() = 0;
 
+	// Copy of this object that still points at the original parent
+	// and children. The caller must relink the hierarchy.
+	virtual SceneObject* clone() const = 0;
+	// Point parent and children at their clones, given a map from
+	// original to clone. Links to objects that were not cloned are dropped.
+	void relink(const std::unordered_map<const SceneObject *, SceneObject *> &clones);
+
 	virtual ~SceneObject();
+
+protected:
+	void markLocalDirty();
+	void markWorldDirty();
+	void objectToWorld(glm::vec3 &point, glm::vec3 &normal) const;
+	Ray worldToObject(const Ray &ray, float &tScale) const;
 };
 
 // Light Class credits to
@@ -95,7 +158,10 @@ public:
 	float getIntensity() { return intensity_m; }
 
 	virtual bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal);
+	virtual bool occluded(const Ray &ray, float tMax);
+	virtual AABB getLocalBounds() const;
 	virtual void draw() { ofDrawSphere(getWorldPosition(), 0.1); }
+	virtual SceneObject* clone() const { return new Light(*this); }
 };
 
 // Plane Class credits to
@@ -118,12 +184,21 @@ public:
 		plane_m.rotateDeg(90, 1, 0, 0);
 		isSelectable_m = false;
 		hasSDF_m = true;
+		isStatic_m = true;
 	}
 	Plane() {}
 
+	glm::vec3 getNormal() const { return normal_m; }
+	// Size of the drawn wireframe, the plane itself is infinite
+	glm::vec2 getDrawSize() const { return glm::vec2(width_m, height_m); }
+
 	virtual bool intersect(const Ray &ray, glm::vec3 & point, glm::vec3 & normal);
+	virtual bool occluded(const Ray &ray, float tMax);
 	virtual float sdf(const glm::vec3 &p);
+	// sdf() measures height above the plane, whatever normal_m is
+	virtual bool sdfGradient(const glm::vec3 &p, glm::vec3 &gradient) const { gradient = glm::vec3(0, 1, 0); return true; }
 	virtual void draw();
+	virtual SceneObject* clone() const { return new Plane(*this); }
 
 };
 
@@ -147,6 +222,7 @@ public:
 
 	glm::vec3 toWorld(float u, float v);   //   (u, v) --> (x, y, z) [ world space ]
 	void draw() { ofDrawRectangle(glm::vec3(min_m.x, min_m.y, getWorldPosition().z), getWidth(), getHeight()); }
+	SceneObject* clone() const { return new ViewPlane(*this); }
 
 	void setSize(glm::vec2 min, glm::vec2 max) { min_m = min; max_m = max; }
 	float getAspect() const { return getWidth() / getHeight(); }
@@ -182,6 +258,8 @@ public:
 		isSelectable_m = false;
 	}
 	void draw();
+	SceneObject* clone() const { return new RenderCam(*this); }
+	virtual void updateMatrices() const;
 
 	Ray getRay(float u, float v);
 	ViewPlane& getView() { return view; }
@@ -199,12 +277,17 @@ public:
 		hasSDF_m = true;
 	}
 
-	float getRadius() { return radius_m; }
+	float getRadius() const { return radius_m; }
 	void setRadius(float rad) { radius_m = rad; }
 
 	virtual bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal);
+	virtual bool occluded(const Ray &ray, float tMax);
+	virtual AABB getLocalBounds() const;
 	virtual float sdf(const glm::vec3 &p);
+	virtual bool getSDFBounds(glm::vec3 &center, float &radius) const { center = getWorldPosition(); radius = radius_m; return true; }
+	virtual bool sdfGradient(const glm::vec3 &p, glm::vec3 &gradient) const;
 	virtual void draw();
+	virtual SceneObject* clone() const { return new Sphere(*this); }
 
 };
 
@@ -221,23 +304,52 @@ public:
 	{
 	}
 
+	float getRadius() const { return radius_m; }
+	float getHeight() const { return height_m; }
 	void setRadius(float r) { radius_m = r; }
 	void setHeight(float h) { height_m = h; }
 
 	virtual bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal);
+	virtual AABB getLocalBounds() const;
 	virtual void draw();
+	virtual SceneObject* clone() const { return new Cone(*this); }
 };
 
 class Mesh : public SceneObject {
 private:
-	ofMesh mesh_m;
+	// Immutable once built, so copies of a Mesh share it
+	struct Geometry
+	{
+		ofMesh mesh_m;
+		TriangleBuffer tris_m;
+		BVH bvh_m;	// object space, built once from tris_m
+	};
+	std::shared_ptr<const Geometry> geometry_m;
+	// File the geometry came from, relative to bin/data, or empty
+	std::string source_m;
 
 public:
-	Mesh(glm::vec3 pos, ofMesh mesh, ofColor diffuse = ofColor::gray) : SceneObject{ pos, diffuse }, mesh_m{ mesh }
+	Mesh(glm::vec3 pos, ofMesh mesh, ofColor diffuse = ofColor::gray) : SceneObject{ pos, diffuse }
 	{
+		buildGeometry(mesh);
 	}
+
+	const BVH& getBVH() const { return geometry_m->bvh_m; }
+	const TriangleBuffer& getTriangles() const { return geometry_m->tris_m; }
+	const ofMesh& getMesh() const { return geometry_m->mesh_m; }
+	const std::string& getSource() const { return source_m; }
+	void setSource(const std::string &source) { source_m = source; }
+	// Bytes held by the geometry, which copies of this Mesh share
+	size_t getGeometryMemoryUsage() const;
+
 	virtual bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal);
+	virtual bool occluded(const Ray &ray, float tMax);
+	virtual AABB getLocalBounds() const;
 	virtual void draw();
+	virtual SceneObject* clone() const { return new Mesh(*this); }
+
+private:
+	void buildGeometry(const ofMesh &mesh);
 };
 
 class Joint : public SceneObject
@@ -291,11 +403,19 @@ public:
 	virtual void setLocalPosition(glm::vec3 pos);
 	virtual void setLocalRotation(glm::vec3 rot);
 	virtual void addChild(SceneObject *child);
+	virtual void updateMatrices() const;
 
 	void adjustConnector();
+	// Node sphere and connector cone, both in joint space. The
+	// connector is only drawn and hit when the joint has a parent.
+	const Sphere& getNode() const { return node_m; }
+	const Cone& getConnector() const { return conn_m; }
 		
 	bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal);
+	bool occluded(const Ray &ray, float tMax);
+	virtual AABB getLocalBounds() const;
 	void draw();
+	SceneObject* clone() const { return new Joint(*this); }
 	
 private:
 	glm::vec3 getMidPoint(glm::vec3 otherPos) { return (getWorldPosition() + otherPos) / 2; }
@@ -0,0 +1,121 @@
+#include "TileScheduler.h"
+
+TileScheduler::TileScheduler(int threadCount)
+{
+	if (threadCount <= 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	for (int i = 0; i < threadCount; i++)
+		queues_m.push_back(std::unique_ptr<WorkQueue>(new WorkQueue));
+
+	// Worker 0 is the thread that calls run()
+	for (int i = 1; i < threadCount; i++)
+		threads_m.emplace_back(&TileScheduler::workerLoop, this, i);
+}
+
+TileScheduler::~TileScheduler()
+{
+	{
+		std::lock_guard<std::mutex> guard(stateLock_m);
+		quit_m = true;
+	}
+	startCond_m.notify_all();
+	for (std::thread &t : threads_m)
+		t.join();
+}
+
+// Split a width x height image into tiles of at most tileSize x tileSize
+std::vector<Tile> TileScheduler::makeTiles(int width, int height, int tileSize)
+{
+	std::vector<Tile> tiles;
+	for (int y = 0; y < height; y += tileSize) {
+		for (int x = 0; x < width; x += tileSize) {
+			tiles.push_back(Tile{ x, y, std::min(x + tileSize, width), std::min(y + tileSize, height) });
+		}
+	}
+	return tiles;
+}
+
+void TileScheduler::run(const std::vector<Tile> &tiles, const TileFunc &func)
+{
+	if (tiles.empty())
+		return;
+
+	int workers = getThreadCount();
+	for (int i = 0; i < tiles.size(); i++)
+		queues_m[i % workers]->tiles.push_back(i);
+
+	{
+		std::lock_guard<std::mutex> guard(stateLock_m);
+		tiles_m = &tiles;
+		func_m = &func;
+		remaining_m = static_cast<int>(tiles.size());
+		busyWorkers_m = workers - 1;
+		generation_m++;
+	}
+	startCond_m.notify_all();
+
+	drain(0);
+
+	// Helpers may still be finishing tiles they popped before the
+	// queues ran empty, wait for all of them to check back in.
+	std::unique_lock<std::mutex> guard(stateLock_m);
+	doneCond_m.wait(guard, [this] { return busyWorkers_m == 0; });
+	tiles_m = nullptr;
+	func_m = nullptr;
+}
+
+void TileScheduler::workerLoop(int worker)
+{
+	unsigned long seen = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> guard(stateLock_m);
+			startCond_m.wait(guard, [this, seen] { return quit_m || generation_m != seen; });
+			if (quit_m)
+				return;
+			seen = generation_m;
+		}
+
+		drain(worker);
+
+		std::lock_guard<std::mutex> guard(stateLock_m);
+		if (--busyWorkers_m == 0)
+			doneCond_m.notify_all();
+	}
+}
+
+void TileScheduler::drain(int worker)
+{
+	int tile;
+	while (remaining_m > 0 && popTile(worker, tile)) {
+		(*func_m)((*tiles_m)[tile], worker);
+		remaining_m--;
+	}
+}
+
+// Own queue first (LIFO), then steal from the others (FIFO)
+bool TileScheduler::popTile(int worker, int &tile)
+{
+	{
+		WorkQueue &own = *queues_m[worker];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (!own.tiles.empty()) {
+			tile = own.tiles.back();
+			own.tiles.pop_back();
+			return true;
+		}
+	}
+
+	int workers = getThreadCount();
+	for (int i = 1; i < workers; i++) {
+		WorkQueue &victim = *queues_m[(worker + i) % workers];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.tiles.empty()) {
+			tile = victim.tiles.front();
+			victim.tiles.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
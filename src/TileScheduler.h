@@ -0,0 +1,76 @@
+#ifndef TILESCHEDULER_H
+#define TILESCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Rectangular block of pixels [x0, x1) x [y0, y1). image tells
+// which image the tile belongs to when several are traced in one run.
+struct Tile
+{
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+	int image = 0;
+};
+
+// Work-stealing thread pool that hands out image tiles.
+//
+// Tiles are dealt round-robin into one deque per worker. A worker
+// takes tiles from the back of its own deque and, once it runs dry,
+// steals from the front of the other workers' deques. The calling
+// thread takes part as worker 0, so run() blocks until every tile
+// has been processed.
+class TileScheduler
+{
+public:
+	typedef std::function<void(const Tile &tile, int worker)> TileFunc;
+
+private:
+	struct WorkQueue
+	{
+		std::mutex lock;
+		std::deque<int> tiles;
+	};
+
+	std::vector<std::thread> threads_m;
+	std::vector<std::unique_ptr<WorkQueue>> queues_m;
+
+	const std::vector<Tile> *tiles_m = nullptr;
+	const TileFunc *func_m = nullptr;
+	std::atomic<int> remaining_m{ 0 };
+	int busyWorkers_m = 0;
+	unsigned long generation_m = 0;
+	bool quit_m = false;
+
+	std::mutex stateLock_m;
+	std::condition_variable startCond_m;
+	std::condition_variable doneCond_m;
+
+public:
+	TileScheduler(int threadCount = 0);
+	~TileScheduler();
+
+	TileScheduler(const TileScheduler &) = delete;
+	TileScheduler &operator=(const TileScheduler &) = delete;
+
+	static std::vector<Tile> makeTiles(int width, int height, int tileSize);
+
+	void run(const std::vector<Tile> &tiles, const TileFunc &func);
+	int getThreadCount() const { return static_cast<int>(queues_m.size()); }
+
+private:
+	void workerLoop(int worker);
+	void drain(int worker);
+	bool popTile(int worker, int &tile);
+};
+
+#endif
@@ -0,0 +1,39 @@
+#include "TriangleBuffer.h"
+
+void TriangleBuffer::build(const ofMesh &mesh)
+{
+	clear();
+
+	// getUniqueFaces resolves indexed and non-indexed meshes alike,
+	// it is only paid for once here instead of on every ray.
+	std::vector<ofMeshFace> faces = mesh.getUniqueFaces();
+	for (std::vector<float> *a : { &v0x_m, &v0y_m, &v0z_m, &e1x_m, &e1y_m, &e1z_m, &e2x_m, &e2y_m, &e2z_m, &nx_m, &ny_m, &nz_m })
+		a->reserve(faces.size());
+
+	for (const ofMeshFace &tri : faces) {
+		glm::vec3 v0 = tri.getVertex(0);
+		glm::vec3 e1 = tri.getVertex(1) - v0;
+		glm::vec3 e2 = tri.getVertex(2) - v0;
+		glm::vec3 n = tri.getFaceNormal();
+		v0x_m.push_back(v0.x); v0y_m.push_back(v0.y); v0z_m.push_back(v0.z);
+		e1x_m.push_back(e1.x); e1y_m.push_back(e1.y); e1z_m.push_back(e1.z);
+		e2x_m.push_back(e2.x); e2y_m.push_back(e2.y); e2z_m.push_back(e2.z);
+		nx_m.push_back(n.x); ny_m.push_back(n.y); nz_m.push_back(n.z);
+	}
+}
+
+void TriangleBuffer::clear()
+{
+	for (std::vector<float> *a : { &v0x_m, &v0y_m, &v0z_m, &e1x_m, &e1y_m, &e1z_m, &e2x_m, &e2y_m, &e2z_m, &nx_m, &ny_m, &nz_m })
+		a->clear();
+}
+
+AABB TriangleBuffer::getBounds(int i) const
+{
+	glm::vec3 v0(v0x_m[i], v0y_m[i], v0z_m[i]);
+	AABB bounds;
+	bounds.grow(v0);
+	bounds.grow(v0 + glm::vec3(e1x_m[i], e1y_m[i], e1z_m[i]));
+	bounds.grow(v0 + glm::vec3(e2x_m[i], e2y_m[i], e2z_m[i]));
+	return bounds;
+}
@@ -0,0 +1,70 @@
+#ifndef TRIANGLEBUFFER_H
+#define TRIANGLEBUFFER_H
+
+#include <vector>
+
+#include "ofMain.h"
+#include "BVH.h"
+
+// Packed triangle storage for ray intersection.
+//
+// Triangles are kept as structure-of-arrays: the first vertex, the two
+// edges leaving it and the unit face normal, all precomputed once from
+// the mesh so that intersecting a ray does no allocation and no
+// per-face copying.
+class TriangleBuffer
+{
+private:
+	std::vector<float> v0x_m, v0y_m, v0z_m;
+	std::vector<float> e1x_m, e1y_m, e1z_m;
+	std::vector<float> e2x_m, e2y_m, e2z_m;
+	std::vector<float> nx_m, ny_m, nz_m;
+
+public:
+	void build(const ofMesh &mesh);
+	void clear();
+
+	int size() const { return static_cast<int>(v0x_m.size()); }
+	size_t getMemoryUsage() const { return 12 * v0x_m.capacity() * sizeof(float); }
+
+	AABB getBounds(int i) const;
+	glm::vec3 getNormal(int i) const { return glm::vec3(nx_m[i], ny_m[i], nz_m[i]); }
+
+	// Moller-Trumbore ray/triangle test. dist is set and true returned
+	// only when the triangle is hit in front of the origin.
+	bool intersect(int i, const glm::vec3 &orig, const glm::vec3 &dir, float &dist) const
+	{
+		float e1x = e1x_m[i], e1y = e1y_m[i], e1z = e1z_m[i];
+		float e2x = e2x_m[i], e2y = e2y_m[i], e2z = e2z_m[i];
+
+		// p = dir x e2
+		float px = dir.y * e2z - dir.z * e2y;
+		float py = dir.z * e2x - dir.x * e2z;
+		float pz = dir.x * e2y - dir.y * e2x;
+		float det = e1x * px + e1y * py + e1z * pz;
+		if (det > -FLT_EPSILON && det < FLT_EPSILON)
+			return false;
+		float invDet = 1.0f / det;
+
+		float tx = orig.x - v0x_m[i], ty = orig.y - v0y_m[i], tz = orig.z - v0z_m[i];
+		float u = (tx * px + ty * py + tz * pz) * invDet;
+		if (u < 0 || u > 1)
+			return false;
+
+		// q = t x e1
+		float qx = ty * e1z - tz * e1y;
+		float qy = tz * e1x - tx * e1z;
+		float qz = tx * e1y - ty * e1x;
+		float v = (dir.x * qx + dir.y * qy + dir.z * qz) * invDet;
+		if (v < 0 || u + v > 1)
+			return false;
+
+		float t = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+		if (t <= 0)
+			return false;
+		dist = t;
+		return true;
+	}
+};
+
+#endif
@@ -1,10 +1,21 @@
 #include "ofMain.h"
 #include "ofApp.h"
 #include "ofAppGLFWWindow.h"
+#include "BenchmarkSuite.h"
+#include "HeadlessRender.h"
+#include "SceneConvert.h"
 
 //========================================================================
-int main( )
+int main(int argc, char *argv[])
 {
+	// Batch rendering, no windows are opened
+	if (HeadlessRender::requested(argc, argv))
+		return HeadlessRender::run(argc, argv);
+	if (BenchmarkSuite::requested(argc, argv))
+		return BenchmarkSuite::run(argc, argv);
+	if (SceneConvert::requested(argc, argv))
+		return SceneConvert::run(argc, argv);
+
 	ofGLFWWindowSettings settings;
 	settings.setSize(1936, 1624);
 	settings.setPosition(glm::vec2(700, 100));
@@ -39,6 +39,9 @@ void ofApp::setup()
 	modelLoader.loadModel("teapot.obj");
 	modelLoader.setRotation(0, 180, 1, 0, 0);
 	modelLoader.setScale(0.03, 0.03, 0.03);
+
+	// Re-rendering after an edit only traces the tiles it touched
+	renderer.setIncremental(true);
 }
 
 //--------------------------------------------------------------
@@ -83,11 +86,21 @@ void ofApp::setupGui()
 	gui.setPosition(50, 700);
 }
 
+//--------------------------------------------------------------
+void ofApp::exit()
+{
+	stopRender();
+}
+
 //--------------------------------------------------------------
 void ofApp::update()
 {
 	if (playAnimation)
+	{
+		// Each animation frame moves the scene
+		stopRender();
 		animator.advanceFrame();
+	}
 }
 
 //--------------------------------------------------------------
@@ -125,6 +138,16 @@ void ofApp::drawGui(ofEventArgs &args)
 	case RENDERING:
 		verdana50.drawString("Rendering", 30, 60);
 		verdana30.drawString(rendControls, 30, 110);
+		{
+			// Upload here, the texture belongs to this window's context
+			std::lock_guard<std::mutex> guard(previewLock);
+			if (previewUpdated) {
+				previewImage.setFromPixels(previewPixels);
+				previewUpdated = false;
+			}
+		}
+		if (previewImage.isAllocated())
+			previewImage.draw(30, 600, 540, 540.0f * previewImage.getHeight() / previewImage.getWidth());
 		break;
 	}
 }
@@ -291,6 +314,10 @@ void ofApp::keyReleased(int key)
 		case '2':
 			animator.initializeEndScene();
 			break;
+		case '3':
+			animator.setKey(animator.getCurrentFrame());
+			std::cout << "Key set at frame " << animator.getCurrentFrame() << ".\n";
+			break;
 		case '~':
 		case '`':
 			if (mainCam.getMouseInputEnabled()) mainCam.disableMouseInput();
@@ -321,13 +348,17 @@ void ofApp::keyReleased(int key)
 		case 'a':
 			renderAnimation();
 			break;
+		case 'B':
+		case 'b':
+			Benchmark::meshIntersect(modelLoader.getMesh(0));
+			break;
 		case 'M':
 		case 'm':
-			renderer.render("imageM.png", Renderer::RenderMethod::RAY_MARCH);
+			startRender("imageM.png", Renderer::RenderMethod::RAY_MARCH);
 			break;
 		case 'T':
 		case 't':
-			renderer.render("imageT.png", Renderer::RenderMethod::RAY_TRACE);
+			startRender("imageT.png", Renderer::RenderMethod::RAY_TRACE);
 			break;
 		case 'X':
 		case 'x':
@@ -375,6 +406,7 @@ void ofApp::mouseMoved(int x, int y )
 void ofApp::mouseDragged(int x, int y, int button)
 {
 	if (objSelected() && dragMouse) {
+		stopRender();
 		glm::vec3 point;
 		mouseToDragPlane(x, y, point);
 		if (bHoldX)
@@ -411,6 +443,7 @@ void ofApp::mousePressed(int x, int y, int button)
 	// if we are moving the camera around, don't allow selection
 	//
 	if (mainCam.getMouseInputEnabled()) return;
+	stopRender();
 
 	// clear selection list
 	//
@@ -427,13 +460,14 @@ void ofApp::mousePressed(int x, int y, int button)
 
 	// check for selection of scene objects
 	//
-	for (int i = 0; i < scene.size(); i++) {
-
-		glm::vec3 point, norm;
+	std::vector<int> hitIndices;
+	pickBVH.update(scene);
+	pickBVH.allHits(Ray(p, dn), hitIndices);
+	for (int i : hitIndices) {
 
 		//  We hit an object
 		//
-		if (scene[i]->selectable() && scene[i]->intersect(Ray(p, dn), point, norm)) {
+		if (scene[i]->selectable()) {
 			hits.push_back(scene[i]);
 		}
 	}
@@ -531,6 +565,7 @@ bool ofApp::mouseToDragPlane(int x, int y, glm::vec3 &point)
 //
 void ofApp::deleteSceneObj(SceneObject* selectedObj)
 {
+	stopRender();
 	scene.erase(std::remove(scene.begin(), scene.end(), selectedObj), scene.end());
 	Light* lightObj = dynamic_cast<Light*>(selectedObj);
 	if (lightObj)
@@ -550,97 +585,37 @@ void ofApp::deleteSceneObj(SceneObject* selectedObj)
 void ofApp::fileSaveSceneObject(SceneObject* selectedObj, std::string filename)
 {
 	std::cout << "Saving " << selectedObj->getName() << " to file " << filename << "...\n";
-	std::ofstream outF{ "data/" + filename, std::ios::trunc };
-	if (!outF)
+	std::vector<SceneObject *> objs{ selectedObj };
+	for (size_t i = 0; i < objs.size(); i++) {
+		const std::vector<SceneObject *> &children = objs[i]->getChildren();
+		objs.insert(objs.end(), children.begin(), children.end());
+	}
+	if (!SceneFile::save("data/" + filename, objs)) {
 		std::cerr << filename << " could not be opened for writing!\n";
-
-	fileSaveSceneObjectRecurse(selectedObj, outF);
-		
-	std::cout << filename << " saved.\n";
-	outF.close();
-}
-
-void ofApp::fileSaveSceneObjectRecurse(SceneObject* selectedObj, std::ofstream &outF)
-{
-	outF << getObjectData(selectedObj) << '\n';
-	if (!selectedObj->getChildList().empty())
-	{
-		for (SceneObject* child : selectedObj->getChildList())
-			fileSaveSceneObjectRecurse(child, outF);
+		return;
 	}
-}
-
-std::string ofApp::getObjectData(SceneObject* selectedObj)
-{
-	std::string output = "create -joint " + selectedObj->getName()
-		+ " -rotate <" + glm::to_string(selectedObj->getLocalRotation()) //<%f, %f, %f>"
-		+ "> -translate <" + glm::to_string(selectedObj->getLocalPosition()) //<%f, %f, %f>"
-		+ "> -parent " + selectedObj->getParentName() + ';';
-	return output;
+	std::cout << filename << " saved.\n";
 }
 
 // Load SceneObject from filename
 //
 void ofApp::fileLoadSceneObject(std::string filename)
 {
+	stopRender();
 	std::cout << "Loading " << filename << "...\n";
-	std::ifstream inF{ "data/" + filename };
-	if (!inF)
-		std::cerr << filename << " could not be opened for reading!\n";
-
 	std::vector<SceneObject *> objs;
-	std::string line;
-	while (std::getline(inF, line))
+	if (!SceneFile::load("data/" + filename, objs))
 	{
-		// Erase spaces
-		line.erase(remove_if(line.begin(), line.end(), isspace), line.end());
-
-		// -jointName-rotate
-		// x         y
-		// nameLen =  y - x - len("-joint")
-		int nameLen = line.find("-rotate") - line.find("-joint") - 6;
-		string name = line.substr(line.find("-joint") + 6, nameLen);
-
-		// -parentParentName;
-		// x                y
-		// parentNameLen =  y - x - len("-parent")
-		int parentNameLen = line.find(";") - line.find("-parent") - 7;
-		string parentName = line.substr(line.find("-parent") + 7, parentNameLen);
-
-		int rotLen = line.find(")") - line.find("(") - 1;
-		string rot = line.substr(line.find("(") + 1, rotLen);
-
-		string nLine = line.substr(line.find(")") + 1);
-		int traLen = nLine.find(")") - nLine.find("(") - 1;
-		string tra = nLine.substr(nLine.find("(") + 1, traLen);
-
-		replace(rot.begin(), rot.end(), ',', ' ');
-		replace(tra.begin(), tra.end(), ',', ' ');
-
-		float data[6];
-		stringstream dataR(rot);
-		stringstream dataT(tra);
-		for (int i = 0; i <= 3; i++) {
-			dataR >> data[i];
-			dataT >> data[i + 3];
-		}
-
-		Joint* newJoint = new Joint(glm::vec3(data[3], data[4], data[5]), 
-			glm::vec3(data[0], data[1], data[2]), 
-			glm::vec3(1, 1, 1), 
-			name);
-		objs.push_back(newJoint);
-		if (parentName.compare("NULL")) {
-			//std::cout << name << " has parent\n";
-			for (SceneObject* obj : objs)
-			{
-				//std::cout << parentName << ' ' << obj->getName() << '\n';
-				if (!parentName.compare(obj->getName()))
-					obj->addChild(newJoint);
-			}
-		}
-		renderObjects.push_back(newJoint);
-		scene.push_back(newJoint);
+		std::cerr << filename << " could not be opened for reading!\n";
+		return;
+	}
+	for (SceneObject* obj : objs)
+	{
+		if (Light* light = dynamic_cast<Light*>(obj))
+			lights.push_back(light);
+		else
+			renderObjects.push_back(obj);
+		scene.push_back(obj);
 	}
 
 	std::cout << filename << " Loaded.\n";
@@ -654,13 +629,19 @@ void ofApp::renderAnimation()
 	{
 		playAnimation = true;
 		animator.play();
-		std::string frameName = "/animation/anim";
-		std::string extension = ".png";
-		animator.animate();
-		for (int i = animator.getMinFrame(); i <= animator.getMaxFrame(); i++)
+		if (animator.ready())
 		{
-			renderer.render(frameName + std::to_string(animator.getCurrentFrame()) + extension, Renderer::RenderMethod::RAY_TRACE);
-			animator.advanceFrame();
+			// Frames are rendered from posed copies of the scene,
+			// several at a time, so the live scene is never moved.
+			AnimationRenderer animRenderer;
+			animRenderer.render(animator, scene, renderObjects, lights, ambientLight,
+				renderer.getCamera().getWorldPosition(), renderer.getWidth(), renderer.getHeight(),
+				animator.getMinFrame(), animator.getMaxFrame(),
+				"/animation/anim", Renderer::RenderMethod::RAY_TRACE);
+		}
+		else
+		{
+			std::cout << "Cannot render animation, set Start and End scenes first.\n";
 		}
 
 		playAnimation = false;
@@ -668,10 +649,57 @@ void ofApp::renderAnimation()
 	}
 }
 
+// Render in the background, coarse pass first, and save
+// the image once the last pass is done
+//
+void ofApp::startRender(std::string filename, Renderer::RenderMethod rend)
+{
+	stopRender();
+
+	// The scene only changes on this thread, so resolve it
+	// here and let the render thread just read it
+	renderer.beginFrame();
+	renderThread = std::thread([this, filename, rend]()
+	{
+		auto start = std::chrono::steady_clock::now();
+		bool finished = renderer.renderProgressive(rend, [this, start](int stride)
+		{
+			std::lock_guard<std::mutex> guard(previewLock);
+			renderer.getPixels(previewPixels);
+			previewUpdated = true;
+			std::cout << "Pass at stride " << stride << " done in "
+				<< std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms\n";
+		});
+		if (!finished)
+		{
+			std::cout << "Render cancelled.\n";
+			return;
+		}
+
+		std::cout << "Saving Image to " << filename << "...\n";
+		ofPixels pixels;
+		renderer.getPixels(pixels);
+		if (ofSaveImage(pixels, filename))
+			std::cout << "Image Saved.\n";
+		else
+			std::cerr << filename << " could not be saved!\n";
+	});
+}
+
+void ofApp::stopRender()
+{
+	if (renderThread.joinable())
+	{
+		renderer.cancel();
+		renderThread.join();
+	}
+}
+
 // GUI buttons event listeners
 //
 void ofApp::addSpherePressed()
 {
+	stopRender();
 	SceneObject* newObject = new Sphere(glm::vec3(0, 0, 0), radiusSlider, colorSlider);
 	renderObjects.push_back(newObject);
 	scene.push_back(newObject);
@@ -679,6 +707,7 @@ void ofApp::addSpherePressed()
 
 void ofApp::addConePressed()
 {
+	stopRender();
 	SceneObject* newObject = new Cone(glm::vec3(0, 0, 0), radiusSlider, heightSlider, colorSlider);
 	renderObjects.push_back(newObject);
 	scene.push_back(newObject);
@@ -686,13 +715,18 @@ void ofApp::addConePressed()
 
 void ofApp::addMeshPressed()
 {
-	SceneObject* newObject = new Mesh(glm::vec3(0, 0, 0), modelLoader.getMesh(0), colorSlider);
+	stopRender();
+	Mesh* newObject = new Mesh(glm::vec3(0, 0, 0), modelLoader.getMesh(0), colorSlider);
+	newObject->setSource("teapot.obj");
+	std::cout << "Mesh BVH built: " << newObject->getBVH().getNodeCount() << " nodes in "
+		<< newObject->getBVH().getBuildTime() << " ms\n";
 	renderObjects.push_back(newObject);
 	scene.push_back(newObject);
 }
 
 void ofApp::addJointPressed()
 {
+	stopRender();
 	if (objSelected() && dynamic_cast<Joint*>(selected[0]))
 	{
 		Joint* newJoint = new Joint(selected[0], "Joint" + std::to_string(jointIndex));
@@ -710,6 +744,7 @@ void ofApp::addJointPressed()
 
 void ofApp::addLightPressed()
 {
+	stopRender();
 	{
 		Light* newLight = new Light(glm::vec3(0, 0, 0), 0.8);
 		lights.push_back(newLight);
@@ -1,16 +1,23 @@
 #ifndef OFAPP_H
 #define OFAPP_H
 
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <glm/gtx/string_cast.hpp>
 
+#include "AnimationRenderer.h"
 #include "Animator.h"
+#include "Benchmark.h"
 #include "ofMain.h"
 #include "ofxAssimpModelLoader.h"
 #include "ofxGui.h"
 #include "Ray.h"
 #include "Renderer.h"
+#include "SceneBVH.h"
+#include "SceneFile.h"
 #include "SceneObject.h"
 
 enum Mode
@@ -52,6 +59,9 @@ private:
 	// every object rendered to prevent pitch black shadows.
 	Light* ambientLight;
 
+	// Picking rays query this instead of scanning the scene
+	SceneBVH pickBVH;
+
 	// Function Variables
 	//
 	int nearestObj = -1;
@@ -75,6 +85,17 @@ private:
 
 	Renderer renderer{renderObjects, lights, ambientLight};
 
+	// T and M render progressively on renderThread. Each pass is
+	// copied to previewPixels, which drawGui shows. Everything that
+	// changes the scene (adding, deleting, loading, dragging objects,
+	// animation playback) cancels the render first, since the render
+	// thread reads the scene lists while it runs.
+	std::thread renderThread;
+	std::mutex previewLock;
+	ofPixels previewPixels;
+	bool previewUpdated = false;
+	ofImage previewImage;
+
 	//--------------------------//
 	//			GUI				//
 	//--------------------------//
@@ -102,6 +123,7 @@ private:
 public:
 	void setup();
 	void setupGui();
+	void exit();
 	void update();
 	void draw();
 	void drawGui(ofEventArgs &args);
@@ -124,10 +146,10 @@ public:
 	bool objSelected() { return (selected.size() ? true : false); };
 	void deleteSceneObj(SceneObject* selectedObj);
 	void fileSaveSceneObject(SceneObject* selectedObj, std::string filename);
-	void fileSaveSceneObjectRecurse(SceneObject* selectedObj, std::ofstream &outF);
-	std::string getObjectData(SceneObject* selectedObj);
 	void fileLoadSceneObject(std::string filename);
 	void renderAnimation();
+	void startRender(std::string filename, Renderer::RenderMethod rend);
+	void stopRender();
 
 	// Gui Event Listener Functions
 	//
@@ -182,6 +204,7 @@ private:
 		"F11- Fullscreen\n"
 		"TAB- Change Modes\n"
 		"A  - RayTrace Animation /animation/\n"
+		"B  - Benchmark Teapot Mesh Intersect\n"
 		"M  - RayMarch Scene imageM.png\n"
 		"T  - RayTrace Scene imageT.png\n";
 };